@@ -25,9 +25,31 @@
  			9.compare acknowledgement from bob.
  
  
- *Compile:          gcc alice.c -ltomcrypt -lzmq -o alice
+ *Compile:          gcc alice.c toycipher.c chacha_kernel.c keystream_ring.c merkle.c hex.c stats.c pool.c compress.c writer.c -ltomcrypt -lzmq -lz -lpthread -o alice
+ *                  (or against the library: gcc alice.c -L. -ltoycipher -ltomcrypt -lzmq -lz -lpthread -o alice, see toycipher.h)
  * 
  *Run example:      ./alice Message1.txt SharedSeed1.txt
+ *                  ./alice BigMessage.bin SharedSeed1.txt --stream [--chunk 65536]   (bob must run with --stream)
+ *                  ./alice BigMessage.bin SharedSeed1.txt --threads 8           (parallel keystream XOR)
+ *                  ./alice BigMessage.bin SharedSeed1.txt --binary | --no-dumps (Key/Ciphertext as .bin, or not at all)
+ *                  ./alice Message1.txt SharedSeed1.txt --endpoint ipc:///tmp/bob.sock --ack-endpoint ipc:///tmp/alice.sock
+ *                                                                               (same endpoints on bob; default tcp 5555/5556)
+ *                  ./alice Message1.txt SharedSeed1.txt --session [--window 16] [--repeat n] [Message2.txt ...]
+ *                                                                               (bob must run with --session)
+ *                  ./alice Message1.txt SharedSeed1.txt --session --prefetch 4194304
+ *                                                                               (keystream computed ahead on a background thread)
+ *                  ./alice BigMessage.bin SharedSeed1.txt --merkle [--leaf 1048576]   (bob must run with --merkle)
+ *                  ./alice Manifest.txt --batch [--workers 8]                  (many message/seed pairs, or a directory;
+ *                                                                               bob must run with the same path and --batch)
+ *                  ./alice BigMessage.bin SharedSeed1.txt --resume [--chunk 1048576] [--window 16]
+ *                                                                               (bob must run with --resume; rerun to resume)
+ *                  ./alice Message1.txt SharedSeed1.txt --writer threads --durable
+ *                                                                               (Key/Ciphertext writes: io_uring (default), threads
+ *                                                                                or sync; --durable fdatasyncs them before exit)
+ *                  ./alice Message1.txt SharedSeed1.txt --session --ack-timeout 500 --retries 8
+ *                                                                               (resend an unacked message after 500 ms, doubling;
+ *                                                                                give up after 8 sends. Other modes: max ack wait)
+ *                  ./alice Log1.json SharedSeed1.txt --session --compress   (deflate before encrypting; also --resume)
  *
  *Documentation:    Libtomcrypt Manual Chapter 8 section 1
  *
@@ -37,17 +59,93 @@ _______________________________________________________________________________*
 //Header Files
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <pthread.h>
 #include <libtomcrypt/tomcrypt.h>
 #include <zmq.h>
+#include "chacha_kernel.h"
+#include "session.h"
+#include "merkle.h"
+#include "hex.h"
+#include "toycipher.h"
 
 //Function prototypes
-unsigned char* Read_File (char fileName[], int *fileLen);
-unsigned char* PRNG(unsigned char *seed, unsigned long seedlen, unsigned long prnlen);
-unsigned char* Hash_SHA256(unsigned char input[], unsigned long inputlen);
-void Show_in_Hex (char name[], unsigned char hex[], int hexlen);
-void Send_via_ZMQ(unsigned char send[], int sendlen);
-unsigned char *Receive_via_ZMQ(unsigned char receive[], int *receivelen, int limit);
-int writeHexToFile(const char* fileName, unsigned char* data, int length);
+void Print_Usage(const char *program);
+long long Stream_Encrypt_Send(char messageFile[], unsigned char *seed, unsigned long seedlen, size_t chunkSize, unsigned char digest[32]);
+void *Ack_Bind(void **context);
+unsigned char *Ack_Receive(void *receiver, zmq_msg_t *ack, size_t *ackLength);
+void Ack_Give_Up(void *context, void *receiver);
+int Wait_For_Ack(void *context, void *receiver, unsigned char originalHash[]);
+int Send_With_Leaves_via_ZMQ(unsigned char send[], size_t sendlen, const merkle_tree *tree);
+int Wait_For_Merkle_Ack(void *context, void *receiver, const merkle_tree *tree, size_t messageLength);
+int Resume_Send(char messageFile[], unsigned char *seed, unsigned long seedlen, size_t chunkSize, int window);
+static long long Now_Ms(void);
+
+typedef struct {
+    int used;                           // waiting for Bob's ack
+    uint64_t seq;
+    int message;                        // index into the message list
+    session_header hdr;                 // as sent, so it can be sent again
+    const unsigned char *body;          // the plaintext (or deflated) bytes behind hdr
+    long long sentAt;                   // ms, CLOCK_MONOTONIC, of the latest send
+    int tries;
+} session_slot;
+
+int Session_Send_All(char *messageFiles[], int messageCount, int repeat, unsigned char *seed, unsigned long seedlen, int window);
+int Session_Send_Message(void *dealer, toycipher_ctx *ctx, const session_header *hdr, const unsigned char *body, int resend);
+int Session_Wait_Ack(void *dealer, toycipher_ctx *ctx, session_slot slots[], int window, unsigned char (*hashes)[32], int *failures);
+int Session_Wait_End(void *dealer);
+
+enum batch_status { BATCH_PENDING = 0, BATCH_OK, BATCH_MISMATCH, BATCH_ERROR };
+
+typedef struct {
+    int status;                         // enum batch_status
+    size_t length;
+    double ms;                          // map + encrypt + send + ack, per pair
+} batch_result;
+
+typedef struct {
+    const toy_batch_pair *pairs;
+    batch_result *results;
+    size_t count;
+    size_t next;                        // next pair to take, shared by the workers
+    void *context;                      // one ZeroMQ context, a DEALER socket per worker
+} batch_job;
+
+long long Batch_Send_All(const toy_batch_pair *pairs, size_t count, int workers);
+
+#define STREAM_CHUNK_SIZE (64 * 1024)   // default chunk size for --stream
+#define STREAM_HWM        8             // chunks ZeroMQ may queue before zmq_send blocks
+#define RESUME_CHECKPOINT "Checkpoint.txt"
+#define RESEND_TIMEOUT_MS 2000          // --session/--resume/--batch: a message not acked in this long is sent again
+#define RESEND_RETRIES    5             // sends per message before Alice gives up (--resume keeps its progress)
+#define ACK_TIMEOUT_MS    60000         // other modes: longest wait for Bob's one ack
+#define RESEND_BACKOFF(tries) ((long long)ackTimeout << ((tries) < 1 ? 0 : (tries) < 10 ? (tries) - 1 : 9))   // --session/--batch: doubles per send
+#define MESSAGE_PREVIEW   4096          // most message bytes echoed to the console
+#define BATCH_MAX_WORKERS 64
+#define BATCH_REPORT      "BatchReport.txt"
+
+static int dumpMode = DUMP_HEX;         // Key/Ciphertext dumps: hex (default), --binary or --no-dumps
+static const char *dataEndpoint = SESSION_ENDPOINT_CONNECT;   // --endpoint: where Bob listens (tcp://, ipc://, inproc://)
+static const char *ackEndpoint = ACK_ENDPOINT_BIND;           // --ack-endpoint: where Alice waits for acks
+static size_t prefetchBytes = 0;        // --prefetch: keystream kept ready ahead by a background thread, 0 = off
+static int compressMode = 0;            // --compress: deflate --session/--resume payloads before encrypting them
+static int writerBackend = WRITER_AUTO; // --writer: how Key/Ciphertext dumps are written (writer.c)
+static int durable = 0;                 // --durable: dumps reach the disk before Alice exits
+static int ackTimeout = -1;             // --ack-timeout ms: per send with --session/--resume/--batch, else the whole wait; 0 = no limit
+static int ackRetries = RESEND_RETRIES; // --retries: sends per message (--session, --resume, --batch)
+
+enum resume_state { CHUNK_UNSENT = 0, CHUNK_IN_FLIGHT, CHUNK_ACKED };
+
+typedef struct {
+    unsigned char state;                // enum resume_state
+    unsigned char tries;
+    long long sentAt;                   // ms, CLOCK_MONOTONIC
+    unsigned char hash[32];             // SHA-256 of the plaintext chunk, filled when sent
+} resume_chunk;
 
 
 /*************************************************************
@@ -55,12 +153,199 @@ int writeHexToFile(const char* fileName, unsigned char* data, int length);
 **************************************************************/
 int main (int argc, char* argv[])
 {   
+    int batchMode = 0;
+    for (int a = 1; a < argc; a++) {                                           //--batch changes the positional layout
+        if (strcmp(argv[a], "--batch") == 0) {
+            batchMode = 1;
+        }
+    }
+    if (argc < 3 || strncmp(argv[1], "--", 2) == 0 || (!batchMode && strncmp(argv[2], "--", 2) == 0)) {
+        Print_Usage(argv[0]);
+        return 1;
+    }
+    int streamMode = 0, sessionMode = 0, merkleMode = 0, resumeMode = 0;
+    int window = SESSION_WINDOW, repeat = 1, workers = 0;
+    size_t chunkSize = 0, leafSize = MERKLE_LEAF_SIZE;
+    char **messageFiles = (char**) malloc(argc * sizeof(char*));
+    int messageCount = 0;
+    messageFiles[messageCount++] = argv[1];
+    int firstOption = batchMode ? 2 : 3;                                       //a batch has no seed argument
+    for (int a = firstOption; a < argc; a++) {
+        if (strcmp(argv[a], "--stream") == 0) {
+            streamMode = 1;
+        } else if (strcmp(argv[a], "--session") == 0) {
+            sessionMode = 1;
+        } else if (strcmp(argv[a], "--window") == 0 && a + 1 < argc) {
+            window = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--repeat") == 0 && a + 1 < argc) {
+            repeat = atoi(argv[++a]);
+        } else if (strncmp(argv[a], "--", 2) != 0) {
+            messageFiles[messageCount++] = argv[a];                            //extra messages for --session
+        } else if (strcmp(argv[a], "--chunk") == 0 && a + 1 < argc) {
+            chunkSize = strtoul(argv[++a], NULL, 10);
+        } else if (strcmp(argv[a], "--threads") == 0 && a + 1 < argc) {
+            Chacha_Kernel_Threads(atoi(argv[++a]));                            //default: one per CPU
+        } else if (strcmp(argv[a], "--merkle") == 0) {
+            merkleMode = 1;
+        } else if (strcmp(argv[a], "--resume") == 0) {
+            resumeMode = 1;
+        } else if (strcmp(argv[a], "--batch") == 0) {
+            continue;                                                          //seen above
+        } else if (strcmp(argv[a], "--workers") == 0 && a + 1 < argc) {
+            workers = atoi(argv[++a]);                                         //--batch, default: one per CPU
+        } else if (strcmp(argv[a], "--endpoint") == 0 && a + 1 < argc) {
+            dataEndpoint = argv[++a];
+        } else if (strcmp(argv[a], "--ack-endpoint") == 0 && a + 1 < argc) {
+            ackEndpoint = argv[++a];
+        } else if (strcmp(argv[a], "--binary") == 0) {
+            dumpMode = DUMP_BINARY;
+        } else if (strcmp(argv[a], "--no-dumps") == 0) {
+            dumpMode = DUMP_NONE;
+        } else if (strcmp(argv[a], "--leaf") == 0 && a + 1 < argc) {
+            leafSize = strtoul(argv[++a], NULL, 10);
+        } else if (strcmp(argv[a], "--prefetch") == 0 && a + 1 < argc) {
+            prefetchBytes = strtoul(argv[++a], NULL, 10);                      //--stream and --session
+        } else if (strcmp(argv[a], "--compress") == 0) {
+            compressMode = 1;                                                  //--session and --resume
+        } else if (strcmp(argv[a], "--stats") == 0 && a + 1 < argc) {
+            Stats_Write_At_Exit(argv[++a], "alice");                           //per-step timings as JSON when we exit
+        } else if (strcmp(argv[a], "--writer") == 0 && a + 1 < argc && Writer_Parse_Backend(argv[a + 1]) >= 0) {
+            writerBackend = Writer_Parse_Backend(argv[++a]);
+        } else if (strcmp(argv[a], "--durable") == 0) {
+            durable = 1;
+        } else if (strcmp(argv[a], "--ack-timeout") == 0 && a + 1 < argc) {
+            ackTimeout = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--retries") == 0 && a + 1 < argc) {
+            ackRetries = atoi(argv[++a]);
+        } else {
+            printf("Unknown option: %s\n", argv[a]);
+            return 1;
+        }
+    }
+    if (chunkSize == 0) {
+        chunkSize = resumeMode ? RESUME_CHUNK_SIZE : STREAM_CHUNK_SIZE;
+    }
+    if (window < 1) {
+        window = 1;
+    }
+    if (leafSize == 0) {
+        leafSize = MERKLE_LEAF_SIZE;
+    }
+    if (ackTimeout < 0) {
+        ackTimeout = sessionMode || resumeMode || batchMode ? RESEND_TIMEOUT_MS : ACK_TIMEOUT_MS;
+    }
+    if ((sessionMode || resumeMode || batchMode) && ackTimeout == 0) {
+        ackTimeout = RESEND_TIMEOUT_MS;                                        //resends need a deadline
+    }
+    if (ackRetries < 1) {
+        ackRetries = 1;
+    }
+    if (streamMode + sessionMode + merkleMode + resumeMode + batchMode > 1) {
+        printf("Pick one of --stream, --session, --merkle, --resume and --batch\n");
+        return 1;
+    }
+    if (batchMode && messageCount > 1) {
+        printf("--batch takes one manifest or directory, not %s\n", messageFiles[1]);
+        Print_Usage(argv[0]);
+        return 1;
+    }
+    if (messageCount > 1 && !sessionMode) {
+        printf("Several messages need --session\n");
+        return 1;
+    }
+    if (compressMode && !sessionMode && !resumeMode) {
+        printf("--compress needs --session or --resume\n");
+        return 1;
+    }
+    Writer_Start(writerBackend, durable);                                       //Key/Ciphertext dumps leave the send path
+
+//---Session mode: one connection for many messages, several in flight, acks matched by sequence number.
+    if (sessionMode) {
+        int seed_length = 0;
+        unsigned char* seed = Read_File(argv[2], &seed_length); //"SharedSeed.txt"
+        printf("Opening a session with Bob (window %d) . . .\n", window);
+        int failures = Session_Send_All(messageFiles, messageCount, repeat, seed, seed_length, window);
+        Pool_Free(seed);
+        FILE* acknowledgmentFile = fopen("Acknowledgment.txt", "w");
+        if (acknowledgmentFile) {
+            fprintf(acknowledgmentFile, failures == 0 ? "Acknowledgment Successful." : "Acknowledgment Failed.");
+            fclose(acknowledgmentFile);
+        }
+        printf("==============The End========================\n");
+        return failures == 0 ? 0 : 1;
+    }
+
+//---Batch mode: every message/seed pair of a manifest (or directory) in one process, on a pool of workers.
+    if (batchMode) {
+        toy_batch_pair *pairs = NULL;
+        size_t count = Toy_Batch_Load(argv[1], &pairs);
+        if (count == 0) {
+            return 1;
+        }
+        printf("Sending %zu message/seed pairs from %s to Bob . . .\n", count, argv[1]);
+        long long failures = Batch_Send_All(pairs, count, workers);
+        FILE* acknowledgmentFile = fopen("Acknowledgment.txt", "w");
+        if (acknowledgmentFile) {
+            fprintf(acknowledgmentFile, failures == 0 ? "Acknowledgment Successful." : "Acknowledgment Failed.");
+            fclose(acknowledgmentFile);
+        }
+        free(pairs);
+        printf("==============The End========================\n");
+        return failures == 0 ? 0 : 1;
+    }
+
+//---Resumable mode: numbered chunks acked one by one, only missing or corrupted chunks are sent again.
+    if (resumeMode) {
+        int seed_length = 0;
+        unsigned char* seed = Read_File(argv[2], &seed_length); //"SharedSeed.txt"
+        int ok = Resume_Send(argv[1], seed, seed_length, chunkSize, window);
+        Pool_Free(seed);
+        FILE* acknowledgmentFile = fopen("Acknowledgment.txt", "w");
+        if (acknowledgmentFile) {
+            fprintf(acknowledgmentFile, ok ? "Acknowledgment Successful." : "Acknowledgment Failed.");
+            fclose(acknowledgmentFile);
+        }
+        printf("==============The End========================\n");
+        return ok ? 0 : 1;
+    }
+
+//---Streaming mode: steps 1-7 happen chunk by chunk, so the message never has to fit in memory.
+    if (streamMode) {
+        int seed_length = 0;
+        unsigned char* seed = Read_File(argv[2], &seed_length); //"SharedSeed.txt"
+        unsigned char digest[32];
+        void *ackContext = NULL;
+        void *receiver = Ack_Bind(&ackContext);                                //listening before Bob can ack
+        printf("Streaming %s to Bob in %zu byte chunks . . .\n", argv[1], chunkSize);
+        long long total = Stream_Encrypt_Send(argv[1], seed, seed_length, chunkSize, digest);
+        Pool_Free(seed);
+        if (total < 0) {
+            Ack_Give_Up(ackContext, receiver);
+            return 1;
+        }
+        printf("Streamed %lld bytes to Bob via ZeroMQ.\n", total);
+        int acknowledged = Wait_For_Ack(ackContext, receiver, digest);
+        printf("==============The End========================\n");
+        return acknowledged ? 0 : 1;
+    }
+
 //---1. Alice reads the message form "Message.txt" file    
+    // The file is mapped rather than copied onto the heap; step 5 encrypts straight out of the
+    // mapping. The SHA-256 for step 9 is computed as the pages are first read, so the
+    // message is not walked a second time after the ack arrives. --merkle checks the ack
+    // against the root that Merkle_Build hashes on every CPU, so it skips this serial pass.
     printf("Getting the Message from File . . .\n");
-    int message_length = 0;
-    unsigned char* message = Read_File(argv[1], &message_length); //"Message.txt"
-	printf("Message: %s", message);
-    printf("Message Length: %d", message_length);
+    size_t read_length = 0;
+    unsigned char originalHash[32];
+    unsigned char* message = Map_File(argv[1], &read_length, merkleMode ? NULL : originalHash); //"Message.txt"
+    if (message == NULL) {
+        return 1;
+    }
+    size_t message_length = read_length;                                      //no size cap: sizes are size_t end to end
+    if (dumpMode != DUMP_NONE) {
+	    printf("Message: %.*s", (int)(message_length < MESSAGE_PREVIEW ? message_length : MESSAGE_PREVIEW), message);   //the mapping has no NUL to stop at
+    }
+    printf("Message Length: %zu", message_length);
     
     printf("\n==================================================\n");
 
@@ -77,55 +362,179 @@ int main (int argc, char* argv[])
 //---3. Alice generates the secret key based on the shared seed by ChaCha20 PRNG.
     printf("Calling the PRNG function . . .\n");
     unsigned char* key = PRNG(seed, seed_length, seed_length);
-    Show_in_Hex("Generated Key", key, seed_length); 
+    if (dumpMode != DUMP_NONE) {
+        Show_in_Hex("Generated Key", key, seed_length); 
+    }
 
     printf("==================================================\n");
     
     
 //---4. Alice writes the Hex format of key in file neamed "Key.txt".
-    if (writeHexToFile("Key.txt", key, seed_length)) {
-        printf("Key written to Key.txt successfully.\n");
+    // --binary writes the raw bytes to Key.bin instead, --no-dumps skips steps 4 and 6.
+    // Steps 4 and 6 only queue the dumps (writer.h); the writer frees the key when it is done.
+    if (dumpMode == DUMP_NONE) {
+        printf("Key dump skipped.\n");
+        Pool_Free(key);
+    } else if (Writer_Dump("Key", key, seed_length, dumpMode, Pool_Free_Msg, NULL)) {
+        printf("Key queued for Key%s.\n", DUMP_EXTENSION(dumpMode));
     } else {
-        printf("Failed to write the key to Key.txt.\n");
+        printf("Failed to write the key to Key%s.\n", DUMP_EXTENSION(dumpMode));
     }   
     
 //---5. Alice XORs message with secret key to obtain ciphertext.
-    unsigned char* ciphertext = malloc(message_length);
-    for (int i = 0; i < message_length; i++) {
-        ciphertext[i] = message[i] ^ key[i];
-    }
+    // The keystream is generated and XORed in the same pass, so no message-sized key buffer is needed.
+    // Large messages are split into ranges that the kernel's thread pool encrypts side by side.
+    unsigned char* ciphertext = Pool_Alloc(message_length);
+    toycipher_ctx cipher;
+    Toy_Init(&cipher, seed, seed_length);
+    Toy_Encrypt_At(&cipher, 0, ciphertext, message, message_length);
+    Toy_Free(&cipher);
+    Pool_Free(seed);
 
 
 //---6. Alice writes the hex format of cipher in ciphertext.txt.
-    if (writeHexToFile("Ciphertext.txt", ciphertext, message_length)) {
-        printf("cipher written to Ciphertext.txt successfully.\n");
+    if (dumpMode == DUMP_NONE) {
+        printf("Ciphertext dump skipped.\n");
+    } else if (Writer_Dump("Ciphertext", ciphertext, message_length, dumpMode, NULL, NULL)) {
+        printf("cipher queued for Ciphertext%s.\n", DUMP_EXTENSION(dumpMode));
     } else {
-        printf("Failed to write the Ciphertext.txt.\n");
+        printf("Failed to write the Ciphertext%s.\n", DUMP_EXTENSION(dumpMode));
     }
     printf("\n==================================================\n");
 
 //---7. Alice sends ciphertext to Bob via zeroMQ.
-    int sendlen = message_length;
-    Send_via_ZMQ(ciphertext, sendlen);
-    printf("Ciphertext sent to Bob via ZeroMQ.\n");
+    // The ack socket is bound first, so Bob's ack is queued for step 8 even if it comes back
+    // before Alice gets there.
+    // With --merkle the message is hashed as a tree of leafSize chunks (all CPUs at once) and the
+    // leaf hashes travel with the ciphertext, so Bob can name exactly which chunks went wrong.
+    void *ackContext = NULL;
+    void *receiver = Ack_Bind(&ackContext);
+    if (merkleMode) {
+        merkle_tree tree;
+        if (!Merkle_Build(&tree, message, message_length, leafSize, 0)) {
+            return 1;
+        }
+        int acknowledged = 0;
+        if (Send_With_Leaves_via_ZMQ(ciphertext, message_length, &tree)) {
+            printf("Ciphertext and %zu leaf hashes sent to Bob via ZeroMQ.\n", tree.leaves);
+            acknowledged = Wait_For_Merkle_Ack(ackContext, receiver, &tree, message_length);
+        } else {
+            Ack_Give_Up(ackContext, receiver);
+        }
+        Merkle_Free(&tree);
+        int written = Writer_Finish();                                         //the Ciphertext dump is still reading it
+        Pool_Free(ciphertext);
+        Unmap_File(message, message_length);
+        printf("==============The End========================\n");
+        return acknowledged && written ? 0 : 1;
+    }
+    size_t sendlen = message_length;
+    int sent = Send_via_ZMQ(dataEndpoint, ciphertext, sendlen, ackTimeout);    //bounded too: Bob may not be there
+    if (sent) {
+        printf("Ciphertext sent to Bob via ZeroMQ.\n");
+    }
+    Unmap_File(message, message_length);
 
 
 //---8. Alice waits for acknowledgement from Bob.
-	unsigned char* receivedAck = malloc(32); // Assuming acknowledgment is 32 bytes (SHA-256 hash size)
-	void *context = zmq_ctx_new();
-	void *receiver = zmq_socket(context, ZMQ_REP); // Create a reply socket to receive acknowledgment
-	
-	zmq_bind(receiver, "tcp://*:5556"); // Binding to new port....pretty sure i went about this wrong making new port...
+//---9.compare acknowledgement from bob.
+	// originalHash was filled in while reading the message in step 1
+	// Gives up after --ack-timeout ms, so a Bob that died does not leave Alice hanging.
+	int acknowledged = 0;
+	if (sent) {
+	    acknowledged = Wait_For_Ack(ackContext, receiver, originalHash);
+	} else {
+	    Ack_Give_Up(ackContext, receiver);
+	}
+
+    int written = Writer_Finish();                                             //the Ciphertext dump is still reading it
+    Pool_Free(ciphertext);
+    printf("==============The End========================\n");
+
+    return acknowledged && written ? 0 : 1;
+
+
+}
+
+/*************************************************************
+					F u n c t i o n s
+**************************************************************/
+
+
+
+
+/*============================
+           Usage
+==============================*/
+//Prints the command line summary for every mode.
+void Print_Usage(const char *program)
+{
+    printf("Usage: %s Message.txt SharedSeed.txt [--stream] [--chunk bytes] [--threads n] [--binary | --no-dumps]\n"
+           "       %s Message.txt SharedSeed.txt --session [--window n] [--repeat n] [--prefetch bytes] [--compress] [more messages...]\n"
+           "       %s Message.txt SharedSeed.txt --merkle [--leaf bytes]\n"
+           "       %s Message.txt SharedSeed.txt --resume [--chunk bytes] [--window n] [--compress]\n"
+           "       %s Manifest.txt|Directory --batch [--workers n]\n"
+           "  any mode: [--endpoint tcp://host:5555 | ipc:///tmp/bob.sock] [--ack-endpoint tcp://*:5556 | ipc:///tmp/alice.sock]\n"
+           "            [--stats stats.json | -] [--writer auto|uring|threads|sync] [--durable]\n"
+           "            [--ack-timeout ms] [--retries n]\n",
+           program, program, program, program, program);
+}
+
+/*============================
+     Waiting for the Ack
+==============================*/
+//Binds the socket Bob's ack arrives on. Alice does this before sending anything: Bob's REQ
+//socket connects as soon as he is done, and a bound socket queues his ack until it is read.
+//Returns the socket; *context is the ZeroMQ context it lives in.
+void *Ack_Bind(void **context)
+{
+    *context = zmq_ctx_new();
+    void *receiver = zmq_socket(*context, ZMQ_REP);
+    if (zmq_bind(receiver, ackEndpoint) != 0) {
+        printf("Could not bind %s: %s\n", ackEndpoint, zmq_strerror(zmq_errno()));
+    }
+    return receiver;
+}
+
+//Polls for Bob's ack for up to --ack-timeout ms (0 = no limit). Returns it like
+//Receive_via_ZMQ, or NULL if nothing came in time.
+unsigned char *Ack_Receive(void *receiver, zmq_msg_t *ack, size_t *ackLength)
+{
+    zmq_pollitem_t item = { receiver, 0, ZMQ_POLLIN, 0 };
+    if (zmq_poll(&item, 1, ackTimeout > 0 ? ackTimeout : -1) <= 0) {
+        printf("No acknowledgment from Bob within %d ms\n", ackTimeout);
+        return NULL;
+    }
+    return Receive_via_ZMQ(receiver, ack, ackLength);
+}
+
+//The message never reached Bob: records a failed acknowledgment and closes the ack socket.
+void Ack_Give_Up(void *context, void *receiver)
+{
+    FILE* acknowledgmentFile = fopen("Acknowledgment.txt", "w");
+    if (acknowledgmentFile) {
+        fprintf(acknowledgmentFile, "Acknowledgment Failed.");
+        fclose(acknowledgmentFile);
+    }
+    zmq_close(receiver);
+    zmq_ctx_destroy(context);
+}
+
+//Steps 8 and 9: waits on the ack endpoint (port 5556 by default) for Bob's hash and records the result in Acknowledgment.txt.
+//No ack within --ack-timeout counts as failed. Closes the socket and its context.
+int Wait_For_Ack(void *context, void *receiver, unsigned char originalHash[])
+{
+	// receiver was bound by Ack_Bind before the ciphertext went out
 	printf("Waiting for acknowledgment from Bob...\n");
 	
-	
-//---9.compare acknowledgement from bob.
-	zmq_recv(receiver, receivedAck, 32, 0); // Receive the acknowledgment from Bob
-	// Calculate the hash of the original message
-	unsigned char* originalHash = Hash_SHA256(message, message_length);
+	zmq_msg_t ack;
+	size_t ackLength = 0;
+	uint64_t t = Stats_Clock();
+	unsigned char* receivedAck = Ack_Receive(receiver, &ack, &ackLength); // Receive the acknowledgment from Bob
+	Stats_Stage(STATS_ACK_WAIT, t, ackLength);
 
-	// Compare received acknowledgment with the hash of the original message
-	int acknowledgmentSuccessful = memcmp(receivedAck, originalHash, 32) == 0;
+	// Compare received acknowledgment with the hash of the original message (SHA-256 hash size is 32 bytes)
+	int acknowledgmentSuccessful = Toy_Ack_Matches(receivedAck, ackLength, originalHash);
 
 	// Write the result to Acknowledgment.txt
 	FILE* acknowledgmentFile = fopen("Acknowledgment.txt", "w");
@@ -141,149 +550,868 @@ int main (int argc, char* argv[])
 	}
 
 	// cleansing our souls from ZeroMQ resources. god bless this cursed thing
+	if (receivedAck) {
+	    zmq_msg_close(&ack);
+	}
 	zmq_close(receiver);
 	zmq_ctx_destroy(context);
 	
 	printf("\n");
 	printf("Acknowledgment properly made.\n");
+	return acknowledgmentSuccessful;
+}
 
+/*============================
+     Streaming Encryption
+==============================*/
+//Walks the mapped message chunk by chunk, XORs each chunk with the next piece of keystream
+//and pushes it to Bob right away. zmq_send only queues the chunk; ZeroMQ's I/O thread
+//puts it on the wire while the kernel reads ahead the next pages (MADV_SEQUENTIAL), so
+//disk and network overlap and at most STREAM_HWM chunks are ever held in memory. Pages
+//already sent are dropped from our mapping (MADV_DONTNEED), so messages larger than RAM
+//stream at a constant footprint. An empty frame marks the end of stream.
+//The SHA-256 of the message is accumulated as we go, so digest[] is ready for the ack
+//as soon as the last chunk is sent.
+long long Stream_Encrypt_Send(char messageFile[], unsigned char *seed, unsigned long seedlen, size_t chunkSize, unsigned char digest[32])
+{
+    size_t length = 0;
+    unsigned char *message = Map_File(messageFile, &length, NULL);
+    if (message == NULL) {
+        return -1;
+    }
+    FILE *keyFile = Dump_Open("Key", dumpMode);                                //dumps are written chunk by chunk too
+    FILE *cipherFile = Dump_Open("Ciphertext", dumpMode);
+    unsigned char *keyChunk = keyFile ? (unsigned char*) malloc(chunkSize) : NULL;
+    long page = sysconf(_SC_PAGESIZE);
 
+    toycipher_ctx ctx;                                                         //one context for the whole stream: keystream and hash advance per chunk
+    Toy_Init(&ctx, seed, seedlen);
+    if (prefetchBytes > 0) {
+        Toy_Prefetch(&ctx, prefetchBytes);
+    }
+    void *pusher = Toy_Socket(&ctx, ZMQ_PUSH);
+    int hwm = STREAM_HWM;
+    zmq_setsockopt(pusher, ZMQ_SNDHWM, &hwm, sizeof(hwm));
+    Toy_Send_Deadline(pusher, ackTimeout);                                     //a chunk Bob does not take in time ends the stream
+    zmq_connect(pusher, dataEndpoint);
 
+    long long total = 0;
+    while ((size_t)total < length) {
+        unsigned char *chunk = message + total;
+        size_t n = length - total < chunkSize ? length - total : chunkSize;
+        zmq_msg_t frame;
+        Toy_Msg_Init(&frame, n);                                               //encrypt straight into the frame ZeroMQ sends
+        unsigned char *cipher = (unsigned char*) zmq_msg_data(&frame);
+        Toy_Encrypt_Update(&ctx, cipher, chunk, n);                            //hashes the plaintext while it is still in cache
+        Dump_Write(cipherFile, cipher, n, dumpMode);
+        if (keyFile) {
+            for (size_t i = 0; i < n; i++) {
+                keyChunk[i] = cipher[i] ^ chunk[i];                            //the key is only recovered for the dump
+            }
+            Dump_Write(keyFile, keyChunk, n, dumpMode);
+        }
+        uint64_t t = Stats_Clock();
+        if (zmq_msg_send(&frame, pusher, 0) < 0) {
+            printf("Send error: %s\n", zmq_strerror(zmq_errno()));
+            zmq_msg_close(&frame);
+            total = -1;
+            break;
+        }
+        Stats_Stage(STATS_SEND, t, n);
+        Stats_Count(STATS_BYTES_SENT, n);
+        total += n;
+        size_t done = (size_t)total / page * page;                             //whole pages behind us
+        if (done > 0) {
+            madvise(message, done, MADV_DONTNEED);
+        }
+    }
+    if (total >= 0) {
+        zmq_send(pusher, "", 0, 0);                                            //end of stream
+        Stats_Count(STATS_MESSAGES_SENT, 1);                                   //the whole stream is one message
+    }
+    Toy_Finish(&ctx, digest);
+    Toy_Free(&ctx);                                                            //blocks until the queued chunks are delivered
+    if (keyFile) fclose(keyFile);
+    if (cipherFile) fclose(cipherFile);
+    Unmap_File(message, length);
+    free(keyChunk);
+    return total;
+}
 
-    printf("==============The End========================\n");
+/*============================
+      Session: Send All
+==============================*/
+//Long-lived session (see session.h): one ZeroMQ context and one DEALER socket for every
+//message, up to `window` messages in flight, acks matched by sequence number. Each file
+//is read and hashed once; with `repeat` the whole list is sent that many times. With
+//--compress each file is also deflated once, and whatever shrinks goes out deflated.
+//Sends and acks overlap: Alice only waits when the window is full, and then only for
+//--ack-timeout ms before she sends the oldest message again (Session_Wait_Ack). A message
+//still unacked after --retries sends, or an END that is never echoed, breaks the session
+//instead of hanging it. Returns the number of messages whose ack did not match, or -1 if
+//the session broke down.
+int Session_Send_All(char *messageFiles[], int messageCount, int repeat, unsigned char *seed, unsigned long seedlen, int window)
+{
+    size_t *lengths = (size_t*) malloc(messageCount * sizeof(size_t));
+    unsigned char **messages = (unsigned char**) malloc(messageCount * sizeof(unsigned char*));
+    unsigned char (*hashes)[32] = malloc(messageCount * sizeof(*hashes));
+    unsigned char **packed = (unsigned char**) calloc(messageCount, sizeof(unsigned char*));   //deflated copy, NULL = sent raw
+    size_t *packedLengths = (size_t*) calloc(messageCount, sizeof(size_t));
+    for (int m = 0; m < messageCount; m++) {
+        messages[m] = Map_File(messageFiles[m], &lengths[m], hashes[m]);
+        if (messages[m] == NULL) {
+            return -1;
+        }
+        if (compressMode) {
+            packedLengths[m] = Compress_Pack(messages[m], lengths[m], &packed[m]);
+        }
+    }
 
-    return 0;
+    toycipher_ctx ctx;                                                         //one keystream for the session, messages back to back
+    Toy_Init(&ctx, seed, seedlen);
+    if (prefetchBytes > 0) {
+        Toy_Prefetch(&ctx, prefetchBytes);                                     //the ring fills while the socket connects
+    }
 
+    session_slot *slots = (session_slot*) calloc(window, sizeof(session_slot));
+    void *dealer = Toy_Socket(&ctx, ZMQ_DEALER);
+    int linger = 0;                                                            //a dead Bob must not block Toy_Free
+    zmq_setsockopt(dealer, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_connect(dealer, dataEndpoint);
 
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    uint64_t total = (uint64_t)messageCount * (repeat > 0 ? repeat : 1);
+    uint64_t offset = 0, bytes = 0, wireBytes = 0;
+    int failures = 0, inflight = 0, broken = 0;
+    for (uint64_t seq = 0; seq < total && !broken; seq++) {
+        int m = (int)(seq % messageCount);
+        while (slots[seq % window].used) {                                     //window full (or that slot's ack is late)
+            int freed = Session_Wait_Ack(dealer, &ctx, slots, window, hashes, &failures);
+            if (freed < 0) {
+                broken = 1;
+                break;
+            }
+            inflight -= freed;
+        }
+        if (broken) {
+            break;
+        }
+
+        const unsigned char *body = packed[m] ? packed[m] : messages[m];
+        size_t len = packed[m] ? packedLengths[m] : lengths[m];                //deflated: only that much keystream is used
+        session_header hdr = { SESSION_MAGIC, SESSION_DATA, seq, offset, len };
+        if (packed[m]) {
+            hdr.plain = lengths[m];
+            hdr.flags = SESSION_DEFLATE;
+        }
+        if (!Session_Send_Message(dealer, &ctx, &hdr, body, 0)) {
+            broken = 1;
+            break;
+        }
+        session_slot *slot = &slots[seq % window];
+        slot->used = 1;
+        slot->seq = seq;
+        slot->message = m;
+        slot->hdr = hdr;
+        slot->body = body;
+        slot->sentAt = Now_Ms();
+        slot->tries = 1;
+        inflight++;
+        offset += len;
+        bytes += lengths[m];
+        wireBytes += len;
+    }
+    while (inflight > 0 && !broken) {                                          //collect the stragglers
+        int freed = Session_Wait_Ack(dealer, &ctx, slots, window, hashes, &failures);
+        if (freed < 0) {
+            broken = 1;
+        }
+        inflight -= freed;
+    }
+
+    session_header end = { SESSION_MAGIC, SESSION_END, total, offset, 0 };
+    zmq_send(dealer, &end, sizeof(end), 0);                                    //sent even when broken, so a live Bob stops
+    if (!broken && !Session_Wait_End(dealer)) {
+        broken = 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    double seconds = (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) / 1e9;
+    printf("Session: %llu messages, %llu bytes in %.3f s (%.0f msg/s), %d failed acks\n",
+           (unsigned long long)total, (unsigned long long)bytes, seconds, seconds > 0 ? total / seconds : 0.0, failures);
+    if (compressMode) {
+        printf("Compression: %llu bytes on the wire (%.1f%% of the plaintext)\n",
+               (unsigned long long)wireBytes, bytes > 0 ? 100.0 * wireBytes / bytes : 0.0);
+    }
+    if (ctx.prefetch) {
+        printf("Prefetch: %llu of %llu bytes XORed from the keystream ring\n",
+               ctx.prefetch->hitBytes, ctx.prefetch->hitBytes + ctx.prefetch->missBytes);
+    }
+
+    Toy_Free(&ctx);
+    for (int m = 0; m < messageCount; m++) {
+        Unmap_File(messages[m], lengths[m]);
+        Pool_Free(packed[m]);
+    }
+    free(messages);
+    free(lengths);
+    free(packed);
+    free(packedLengths);
+    free(hashes);
+    free(slots);
+    return broken ? -1 : failures;
 }
 
-/*************************************************************
-					F u n c t i o n s
-**************************************************************/
-//converts to readable format in files.
-int writeHexToFile(const char* fileName, unsigned char* data, int length) {
-    FILE* file = fopen(fileName, "w");
-    if (file == NULL) {
-        printf("error opening file for w.");
-        return 0;
+//Waits for Bob's echo of END, skipping late acks of resent messages that may still be ahead
+//of it. Bob may still be working through resends, so the wait is as long as the last resend's.
+//Returns 0 if it does not come.
+int Session_Wait_End(void *dealer)
+{
+    long long deadline = Now_Ms() + RESEND_BACKOFF(ackRetries);
+    for (;;) {
+        session_header end;
+        zmq_pollitem_t item = { dealer, 0, ZMQ_POLLIN, 0 };
+        long long wait = deadline - Now_Ms();
+        if (wait <= 0 || zmq_poll(&item, 1, wait) <= 0) {
+            printf("Bob did not confirm the end of the session\n");
+            return 0;
+        }
+        if (zmq_recv(dealer, &end, sizeof(end), 0) == sizeof(end) && end.magic == SESSION_MAGIC && end.type == SESSION_END) {
+            return 1;
+        }
+    }
+}
+
+//Encrypts body[hdr->length] at keystream byte hdr->offset into a pool buffer and sends it
+//behind hdr. A first send moves the session's keystream position on (and reads the prefetch
+//ring); a resend encrypts at hdr->offset again and leaves the position alone. Returns 1 if
+//ZeroMQ took the frame.
+int Session_Send_Message(void *dealer, toycipher_ctx *ctx, const session_header *hdr, const unsigned char *body, int resend)
+{
+    zmq_msg_t payload;
+    Toy_Msg_Init(&payload, hdr->length);                                       //pool buffer, back in the pool once sent
+    if (resend) {
+        Toy_Encrypt_At(ctx, hdr->offset, zmq_msg_data(&payload), body, hdr->length);
+    } else {
+        Toy_Crypt_Update(ctx, zmq_msg_data(&payload), body, hdr->length);      //at keystream byte hdr->offset
     }
-    for (int i = 0; i < length; i++) {
-        fprintf(file, "%02x", data[i]);
+    uint64_t t = Stats_Clock();
+    zmq_send(dealer, hdr, sizeof(*hdr), ZMQ_SNDMORE);
+    if (zmq_msg_send(&payload, dealer, 0) < 0) {
+        printf("Send error: %s\n", zmq_strerror(zmq_errno()));
+        zmq_msg_close(&payload);
+        return 0;
     }
-    fclose(file);
+    Stats_Stage(STATS_SEND, t, hdr->length);
+    Stats_Count(STATS_MESSAGES_SENT, 1);
+    Stats_Count(STATS_BYTES_SENT, hdr->length);
     return 1;
 }
 
+//Waits for the next ACK and checks it against the hash of the message that went out with
+//the same sequence number. If none comes before the first message in flight is due, that
+//message is sent again, at most --retries times in all. A message is due --ack-timeout ms
+//after its first send, and the wait doubles with every resend, so a Bob that is merely
+//slow is not buried in duplicates. Returns 1 if an ack freed a slot, 0 if not (a resend,
+//or a late ack of a message already acked), or -1 if the session is broken.
+int Session_Wait_Ack(void *dealer, toycipher_ctx *ctx, session_slot slots[], int window, unsigned char (*hashes)[32], int *failures)
+{
+    session_slot *oldest = NULL;
+    long long due = 0;
+    for (int w = 0; w < window; w++) {
+        if (!slots[w].used) {
+            continue;
+        }
+        long long slotDue = slots[w].sentAt + RESEND_BACKOFF(slots[w].tries);
+        if (oldest == NULL || slotDue < due) {
+            oldest = &slots[w];
+            due = slotDue;
+        }
+    }
+    if (oldest == NULL) {
+        return 0;
+    }
+    long long wait = due - Now_Ms();
+    zmq_pollitem_t item = { dealer, 0, ZMQ_POLLIN, 0 };
+    uint64_t t = Stats_Clock();
+    if (zmq_poll(&item, 1, wait > 0 ? wait : 0) < 0) {
+        printf("Poll error: %s\n", zmq_strerror(zmq_errno()));
+        return -1;
+    }
+    if (!(item.revents & ZMQ_POLLIN)) {
+        if (oldest->tries >= ackRetries) {
+            printf("No ack for message %llu after %d sends, giving up\n", (unsigned long long)oldest->seq, oldest->tries);
+            return -1;
+        }
+        printf("No ack for message %llu within %lld ms, sending it again\n", (unsigned long long)oldest->seq, RESEND_BACKOFF(oldest->tries));
+        if (!Session_Send_Message(dealer, ctx, &oldest->hdr, oldest->body, 1)) {
+            return -1;
+        }
+        oldest->tries++;
+        oldest->sentAt = Now_Ms();
+        return 0;
+    }
 
-
+    session_header hdr;
+    unsigned char ack[32];
+    int more = 0;
+    size_t moreSize = sizeof(more);
+    if (zmq_recv(dealer, &hdr, sizeof(hdr), 0) != sizeof(hdr) || hdr.magic != SESSION_MAGIC || hdr.type != SESSION_ACK) {
+        printf("Unexpected frame from Bob\n");
+        return -1;
+    }
+    Stats_Stage(STATS_ACK_WAIT, t, 0);
+    zmq_getsockopt(dealer, ZMQ_RCVMORE, &more, &moreSize);
+    if (!more || zmq_recv(dealer, ack, sizeof(ack), 0) != sizeof(ack)) {
+        printf("Ack for message %llu has no hash\n", (unsigned long long)hdr.seq);
+        return -1;
+    }
+    session_slot *slot = &slots[hdr.seq % window];
+    if (!slot->used || slot->seq != hdr.seq) {
+        return 0;                                                              //second ack of a resent message
+    }
+    if (!Toy_Ack_Matches(ack, sizeof(ack), hashes[slot->message])) {
+        printf("Acknowledgment Failed for message %llu\n", (unsigned long long)hdr.seq);
+        (*failures)++;
+    }
+    slot->used = 0;
+    return 1;
+}
 
 /*============================
-        Read from File
+        Batch: Worker
 ==============================*/
-unsigned char* Read_File (char fileName[], int *fileLen)
+//Takes pairs off the shared counter until there are none left. Each pair is mapped and
+//hashed, encrypted under its own seed from keystream byte 0 (exactly what a separate
+//./alice MessageN.txt SharedSeedN.txt run would send) and sent as a BATCH frame with
+//seq = its index in the list, which Bob uses to pick the seed. The worker waits for that
+//ack before taking the next pair; the other workers keep Bob busy meanwhile. The wait is
+//polled like Session_Wait_Ack: a pair not acked in time is sent again (Bob keeps nothing
+//per pair, so a second copy is harmless), with the wait doubling each time, and after
+//--retries sends the worker gives up on Bob.
+static void *Batch_Worker(void *arg)
 {
-    FILE *pFile;
-    pFile = fopen(fileName, "r");
-    if (pFile == NULL)
-    {
-	printf("Error opening file.\n");
-	exit(0);
-    }
-    fseek(pFile, 0L, SEEK_END);
-    int temp_size = ftell(pFile)+1;
-    fseek(pFile, 0L, SEEK_SET);
-    unsigned char *output = (unsigned char*) malloc(temp_size);
-    fgets(output, temp_size, pFile);
-    fclose(pFile);
-
-    *fileLen = temp_size-1;
-    return output;
+    batch_job *job = (batch_job*) arg;
+    void *dealer = zmq_socket(job->context, ZMQ_DEALER);
+    int linger = 0;                                                            //a dead Bob must not block zmq_ctx_destroy
+    zmq_setsockopt(dealer, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_connect(dealer, dataEndpoint);
+    size_t i;
+    while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->count) {
+        batch_result *result = &job->results[i];
+        struct timespec started, finished;
+        clock_gettime(CLOCK_MONOTONIC, &started);
+
+        unsigned char digest[32];
+        size_t length = 0;
+        unsigned char *message = Map_File((char*) job->pairs[i].message, &length, digest);
+        if (message == NULL) {
+            result->status = BATCH_ERROR;
+            continue;
+        }
+        int seed_length = 0;
+        unsigned char *seed = Read_File((char*) job->pairs[i].seed, &seed_length);
+        toycipher_ctx cipher;
+        Toy_Init(&cipher, seed, seed_length);
+        session_header hdr = { SESSION_MAGIC, SESSION_BATCH, i, 0, length };
+        zmq_msg_t payload;
+        Toy_Msg_Init(&payload, length);
+        Toy_Encrypt_At(&cipher, 0, zmq_msg_data(&payload), message, length);
+        Toy_Free(&cipher);
+        Pool_Free(seed);
+        Unmap_File(message, length);
+        result->length = length;
+
+        unsigned char ack[32];
+        int acked = 0, sent = 1;
+        for (int tries = 1; tries <= ackRetries && !acked && sent; tries++) {
+            zmq_msg_t copy;                                                    //payload stays ours for a resend
+            zmq_msg_init(&copy);
+            zmq_msg_copy(&copy, &payload);
+            uint64_t t = Stats_Clock();
+            zmq_send(dealer, &hdr, sizeof(hdr), ZMQ_SNDMORE);
+            sent = zmq_msg_send(&copy, dealer, 0) >= 0;
+            if (!sent) {
+                zmq_msg_close(&copy);
+                break;
+            }
+            Stats_Stage(STATS_SEND, t, length);
+            Stats_Count(STATS_MESSAGES_SENT, 1);
+            Stats_Count(STATS_BYTES_SENT, length);
+            t = Stats_Clock();
+            long long due = Now_Ms() + RESEND_BACKOFF(tries);
+            while (!acked) {
+                session_header reply;
+                int more = 0;
+                size_t moreSize = sizeof(more);
+                zmq_pollitem_t item = { dealer, 0, ZMQ_POLLIN, 0 };
+                long long wait = due - Now_Ms();
+                if (wait <= 0 || zmq_poll(&item, 1, wait) <= 0) {
+                    if (tries < ackRetries) {
+                        printf("Pair %zu: no ack within %lld ms, sending it again\n", i, RESEND_BACKOFF(tries));
+                    }
+                    break;
+                }
+                if (zmq_recv(dealer, &reply, sizeof(reply), 0) != sizeof(reply)) {
+                    continue;                                                  //stray frame
+                }
+                zmq_getsockopt(dealer, ZMQ_RCVMORE, &more, &moreSize);
+                int got = more ? zmq_recv(dealer, ack, sizeof(ack), 0) : 0;
+                if (reply.magic == SESSION_MAGIC && reply.type == SESSION_ACK && reply.seq == i && got == sizeof(ack)) {
+                    Stats_Stage(STATS_ACK_WAIT, t, 0);
+                    acked = 1;                                                 //other seqs: late acks of earlier resends
+                }
+            }
+        }
+        zmq_msg_close(&payload);
+        if (!acked) {
+            printf("Pair %zu (%s): no valid ack from Bob\n", i, job->pairs[i].message);
+            result->status = BATCH_ERROR;
+            break;                                                             //Bob is not answering this socket
+        }
+        result->status = Toy_Ack_Matches(ack, sizeof(ack), digest) ? BATCH_OK : BATCH_MISMATCH;
+        clock_gettime(CLOCK_MONOTONIC, &finished);
+        result->ms = (finished.tv_sec - started.tv_sec) * 1e3 + (finished.tv_nsec - started.tv_nsec) / 1e6;
+    }
+    zmq_close(dealer);
+    return NULL;
 }
 
 /*============================
-        SHA-256 Fucntion
+        Batch: Send All
 ==============================*/
-unsigned char* Hash_SHA256(unsigned char* input, unsigned long inputlen)
+//Runs `workers` Batch_Worker threads (0 = one per CPU) over all pairs, then closes the batch
+//with END so Bob exits, and writes one line per pair to BatchReport.txt in list order.
+//Returns the number of pairs that did not verify.
+long long Batch_Send_All(const toy_batch_pair *pairs, size_t count, int workers)
 {
-    unsigned char *hash_result = (unsigned char*) malloc(inputlen);
-    //int err;
-    hash_state md;                                                         //LibTomCrypt structure for hash
-    sha256_init(&md);                                                      //Initializing the hash set up
-    sha256_process(&md, (const unsigned char*)input, inputlen);            //Hashing the data given as input with specified length
-    sha256_done(&md, hash_result);                                         //Produces the hash (message digest)
-    
-    return hash_result;
+    if (workers <= 0) {
+        workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (workers > BATCH_MAX_WORKERS) {
+        workers = BATCH_MAX_WORKERS;
+    }
+    if ((size_t)workers > count) {
+        workers = (int)count;
+    }
+    batch_job job = { pairs, (batch_result*) calloc(count, sizeof(batch_result)), count, 0, zmq_ctx_new() };
+    pthread_t threads[BATCH_MAX_WORKERS];
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    int running = 0;
+    for (int w = 0; w < workers; w++) {
+        if (pthread_create(&threads[running], NULL, Batch_Worker, &job) == 0) {
+            running++;
+        }
+    }
+    if (running == 0) {
+        Batch_Worker(&job);                                                    //no threads, do it here
+    }
+    for (int w = 0; w < running; w++) {
+        pthread_join(threads[w], NULL);
+    }
+
+    void *dealer = zmq_socket(job.context, ZMQ_DEALER);                        //every ack is in, tell Bob we are done
+    int linger = 0;
+    zmq_setsockopt(dealer, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_connect(dealer, dataEndpoint);
+    session_header end = { SESSION_MAGIC, SESSION_END, count, 0, 0 };
+    zmq_send(dealer, &end, sizeof(end), 0);
+    int closed = Session_Wait_End(dealer);
+    zmq_close(dealer);
+    zmq_ctx_destroy(job.context);
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    double seconds = (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) / 1e9;
+
+    static const char *names[] = { "NOT SENT", "OK", "FAILED", "ERROR" };
+    long long failures = 0;
+    unsigned long long bytes = 0;
+    FILE *report = fopen(BATCH_REPORT, "w");
+    for (size_t i = 0; i < count; i++) {
+        if (job.results[i].status != BATCH_OK) {
+            failures++;
+            printf("Pair %zu (%s, %s): %s\n", i, pairs[i].message, pairs[i].seed, names[job.results[i].status]);
+        }
+        bytes += job.results[i].length;
+        if (report) {
+            fprintf(report, "%zu %s %s %s %zu %.3f\n", i, pairs[i].message, pairs[i].seed,
+                    names[job.results[i].status], job.results[i].length, job.results[i].ms);
+        }
+    }
+    if (report) fclose(report);
+    printf("Batch: %zu pairs, %llu bytes, %d workers in %.3f s (%.0f pairs/s): %zu ok, %lld failed\n",
+           count, bytes, running ? running : 1, seconds, seconds > 0 ? count / seconds : 0.0,
+           count - (size_t)failures, failures);
+    printf("Per-pair results written to %s\n", BATCH_REPORT);
+    free(job.results);
+    return closed ? failures : failures + 1;
 }
 
 /*============================
-        Showing in Hex 
+      Resumable Transfer
 ==============================*/
-void Show_in_Hex (char name[], unsigned char hex[], int hexlen)
+static long long Now_Ms(void)
 {
-    printf("%s: ", name);
-    for (int i = 0 ; i < hexlen ; i++)
-	printf("%02x", hex[i]);
-	printf("\n");
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
-/*============================
-        PRNG Fucntion 
-==============================*/
-unsigned char* PRNG(unsigned char *seed, unsigned long seedlen, unsigned long prnlen)
+//Reads RESUME_CHECKPOINT and marks the chunks it lists as acked. The first line ties the
+//checkpoint to this exact message ("<sha256 hex> <size> <chunk size>"); a checkpoint for a
+//different message or chunk size is ignored. Returns the number of chunks restored.
+static size_t Resume_Load_Checkpoint(const char *header, resume_chunk *chunks, size_t count)
 {
-    int err;
-    unsigned char *pseudoRandomNumber = (unsigned char*) malloc(prnlen);
-
-    prng_state prng;                                                           //LibTomCrypt structure for PRNG
-    if ((err = chacha20_prng_start(&prng)) != CRYPT_OK){                       //Sets up the PRNG state without a seed
-        printf("Start error: %s\n", error_to_string(err));
-    }					                
-    if ((err = chacha20_prng_add_entropy(seed, seedlen, &prng)) != CRYPT_OK) {      //Uses a seed to add entropy to the PRNG
-        printf("Add_entropy error: %s\n", error_to_string(err));
-    }	            
-    if ((err = chacha20_prng_ready(&prng)) != CRYPT_OK) {                      //Puts the entropy into action
-        printf("Ready error: %s\n", error_to_string(err));
-    }
-    chacha20_prng_read(pseudoRandomNumber, prnlen, &prng);                     //Writes the result into pseudoRandomNumber[]
-    
-    if ((err = chacha20_prng_done(&prng)) != CRYPT_OK) {                       //Finishes the PRNG state
-        printf("Done error: %s\n", error_to_string(err));
+    FILE *f = fopen(RESUME_CHECKPOINT, "r");
+    if (f == NULL) {
+        return 0;
     }
+    char line[256];
+    size_t restored = 0;
+    if (fgets(line, sizeof(line), f) && strcmp(line, header) == 0) {
+        unsigned long long index;
+        while (fscanf(f, "%llu", &index) == 1) {
+            if (index < count && chunks[index].state != CHUNK_ACKED) {
+                chunks[index].state = CHUNK_ACKED;
+                restored++;
+            }
+        }
+    } else {
+        printf("%s belongs to another transfer, starting over\n", RESUME_CHECKPOINT);
+    }
+    fclose(f);
+    return restored;
+}
 
-    return (unsigned char*)pseudoRandomNumber;
+//Frees the slot holding chunk `index`, if any.
+static int Resume_Release_Slot(long long slots[], int window, uint64_t index)
+{
+    for (int w = 0; w < window; w++) {
+        if (slots[w] == (long long)index) {
+            slots[w] = -1;
+            return 1;
+        }
+    }
+    return 0;
 }
 
+//Alice's side of --resume. The message is cut into chunkSize chunks; chunk i is a session DATA
+//frame with seq = i and offset = i * chunkSize (which is also its keystream offset), so any
+//chunk can be sent, lost and sent again on its own. Up to `window` chunks are in flight. Bob
+//acks each one with the SHA-256 of what he decrypted:
+//  - hash matches   -> chunk is done, its index is appended to RESUME_CHECKPOINT
+//  - hash differs   -> corrupted, queued again at once
+//  - no ack in --ack-timeout ms (RESEND_TIMEOUT_MS) -> lost, queued again
+//When every chunk is acked Alice sends END with the message length; Bob trims Plaintext.txt to
+//it and answers with the SHA-256 of the whole file, which must match the message's hash.
+//If Alice is stopped she starts again from the checkpoint. With --compress each chunk is
+//deflated on its own (a resend deflates it again). Returns 1 on success.
+int Resume_Send(char messageFile[], unsigned char *seed, unsigned long seedlen, size_t chunkSize, int window)
+{
+    unsigned char digest[32];                                                  //whole message, for the END check and the checkpoint
+    size_t mappedLength = 0;
+    unsigned char *message = Map_File(messageFile, &mappedLength, digest);    //chunks are encrypted straight from the mapping
+    if (message == NULL) {
+        return 0;
+    }
+    uint64_t length = mappedLength;
+    hash_state md;
+
+    char header[128];
+    int pos = 0;
+    for (int i = 0; i < 32; i++) {
+        pos += sprintf(header + pos, "%02x", digest[i]);
+    }
+    sprintf(header + pos, " %llu %zu\n", (unsigned long long)length, chunkSize);
+
+    size_t count = (size_t)((length + chunkSize - 1) / chunkSize);
+    resume_chunk *chunks = (resume_chunk*) calloc(count ? count : 1, sizeof(resume_chunk));
+    size_t acked = Resume_Load_Checkpoint(header, chunks, count);
+    if (acked > 0) {
+        printf("Resuming: %zu of %zu chunks already acknowledged\n", acked, count);
+    }
+    FILE *checkpoint = fopen(RESUME_CHECKPOINT, acked > 0 ? "a" : "w");
+    if (checkpoint == NULL) {
+        printf("Could not write %s\n", RESUME_CHECKPOINT);
+    } else if (acked == 0) {
+        fputs(header, checkpoint);
+        fflush(checkpoint);
+    }
+
+    toycipher_ctx ctx;
+    Toy_Init(&ctx, seed, seedlen);
+
+    long long *slots = (long long*) malloc(window * sizeof(long long));      //chunk index per in-flight slot, -1 = free
+    for (int w = 0; w < window; w++) {
+        slots[w] = -1;
+    }
+    void *dealer = Toy_Socket(&ctx, ZMQ_DEALER);
+    int linger = 0;
+    zmq_setsockopt(dealer, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_connect(dealer, dataEndpoint);
+    printf("Sending %s to Bob in %zu chunks of %zu bytes (window %d) . . .\n", messageFile, count, chunkSize, window);
+
+    size_t next = 0, resent = 0, corrupted = 0;
+    int inflight = 0, ok = 1;
+    while (acked < count && ok) {
+//------Fill the window with unsent chunks, lowest index first.
+        while (inflight < window) {
+            while (next < count && chunks[next].state != CHUNK_UNSENT) {
+                next++;
+            }
+            if (next == count) {
+                break;
+            }
+            resume_chunk *c = &chunks[next];
+            if (c->tries >= ackRetries) {
+                printf("Chunk %zu failed %d times, giving up (rerun to resume)\n", next, ackRetries);
+                ok = 0;
+                break;
+            }
+            uint64_t offset = (uint64_t)next * chunkSize;
+            size_t len = length - offset < chunkSize ? (size_t)(length - offset) : chunkSize;
+            const unsigned char *buffer = message + offset;
+            sha256_init(&md);
+            sha256_process(&md, buffer, len);
+            sha256_done(&md, c->hash);
+
+            session_header hdr = { SESSION_MAGIC, SESSION_DATA, next, offset, len };
+            unsigned char *packed = NULL;
+            if (compressMode && (hdr.length = Compress_Pack(buffer, len, &packed)) > 0) {
+                hdr.plain = len;                                               //keystream from `offset` for the deflated
+                hdr.flags = SESSION_DEFLATE;                                   //bytes only: still inside this chunk's range
+                buffer = packed;
+            } else {
+                hdr.length = len;
+            }
+            zmq_msg_t payload;
+            Toy_Msg_Init(&payload, hdr.length);
+            Toy_Encrypt_At(&ctx, offset, zmq_msg_data(&payload), buffer, hdr.length);
+            Pool_Free(packed);
+            uint64_t t = Stats_Clock();
+            zmq_send(dealer, &hdr, sizeof(hdr), ZMQ_SNDMORE);
+            zmq_msg_send(&payload, dealer, 0);
+            Stats_Stage(STATS_SEND, t, hdr.length);
+            Stats_Count(STATS_MESSAGES_SENT, 1);
+            Stats_Count(STATS_BYTES_SENT, hdr.length);
+            if (c->tries > 0) {
+                resent++;
+            }
+            c->tries++;
+            c->state = CHUNK_IN_FLIGHT;
+            c->sentAt = Now_Ms();
+            for (int w = 0; w < window; w++) {
+                if (slots[w] < 0) {
+                    slots[w] = (long long)next;
+                    break;
+                }
+            }
+            inflight++;
+        }
+        if (!ok || inflight == 0) {
+            continue;
+        }
+
+//------Take whatever acks arrive within the timeout.
+        zmq_pollitem_t item = { dealer, 0, ZMQ_POLLIN, 0 };
+        zmq_poll(&item, 1, 100);
+        while (item.revents & ZMQ_POLLIN) {
+            session_header hdr;
+            unsigned char ack[32];
+            if (zmq_recv(dealer, &hdr, sizeof(hdr), ZMQ_DONTWAIT) != sizeof(hdr)) {
+                break;
+            }
+            int more = 0;
+            size_t moreSize = sizeof(more);
+            zmq_getsockopt(dealer, ZMQ_RCVMORE, &more, &moreSize);
+            int got = more ? zmq_recv(dealer, ack, sizeof(ack), 0) : 0;
+            if (got != sizeof(ack) || hdr.magic != SESSION_MAGIC || hdr.type != SESSION_ACK || hdr.seq >= count) {
+                continue;                                                      //not a chunk ack, ignore it
+            }
+            resume_chunk *c = &chunks[hdr.seq];
+            if (Resume_Release_Slot(slots, window, hdr.seq)) {
+                inflight--;
+            }
+            if (c->state == CHUNK_ACKED) {
+                continue;                                                      //late duplicate of a resent chunk
+            }
+            if (c->tries > 0 && memcmp(ack, c->hash, 32) == 0) {               //may be the ack of a send we had given up on
+                c->state = CHUNK_ACKED;
+                acked++;
+                if (checkpoint) {
+                    fprintf(checkpoint, "%llu\n", (unsigned long long)hdr.seq);
+                    fflush(checkpoint);
+                }
+            } else if (c->state == CHUNK_IN_FLIGHT) {
+                printf("Chunk %llu arrived corrupted, sending it again\n", (unsigned long long)hdr.seq);
+                corrupted++;
+                c->state = CHUNK_UNSENT;
+                if (hdr.seq < next) {
+                    next = hdr.seq;
+                }
+            }
+        }
+
+//------Anything not acked in time is assumed lost.
+        long long now = Now_Ms();
+        for (int w = 0; w < window; w++) {
+            if (slots[w] >= 0 && now - chunks[slots[w]].sentAt > ackTimeout) {
+                chunks[slots[w]].state = CHUNK_UNSENT;
+                if ((size_t)slots[w] < next) {
+                    next = (size_t)slots[w];
+                }
+                slots[w] = -1;
+                inflight--;
+            }
+        }
+    }
+
+//---Every chunk is in: ask Bob for the hash of the whole file.
+    if (ok) {
+        ok = 0;
+        for (int attempt = 0; attempt < ackRetries && !ok; attempt++) {
+            session_header end = { SESSION_MAGIC, SESSION_END, count, length, 0 };
+            zmq_send(dealer, &end, sizeof(end), 0);
+            long long deadline = Now_Ms() + ackTimeout;
+            while (Now_Ms() < deadline) {
+                zmq_pollitem_t item = { dealer, 0, ZMQ_POLLIN, 0 };
+                if (zmq_poll(&item, 1, 100) <= 0) {
+                    continue;
+                }
+                session_header hdr;
+                unsigned char fileHash[32];
+                int more = 0;
+                size_t moreSize = sizeof(more);
+                zmq_recv(dealer, &hdr, sizeof(hdr), 0);
+                zmq_getsockopt(dealer, ZMQ_RCVMORE, &more, &moreSize);
+                int got = more ? zmq_recv(dealer, fileHash, sizeof(fileHash), 0) : 0;
+                if (hdr.magic == SESSION_MAGIC && hdr.type == SESSION_END && got == sizeof(fileHash)) {
+                    ok = Toy_Ack_Matches(fileHash, got, digest) ? 1 : -1;
+                    break;
+                }
+            }
+        }
+        if (ok == 0) {
+            printf("Bob did not confirm the end of the transfer (rerun to resume)\n");
+        } else if (ok < 0) {
+            printf("Bob's copy does not match the message, the checkpoint is dropped\n");
+            ok = 0;
+            if (checkpoint) {
+                fclose(checkpoint);
+                checkpoint = NULL;
+            }
+            remove(RESUME_CHECKPOINT);
+        } else {
+            if (checkpoint) {
+                fclose(checkpoint);
+                checkpoint = NULL;
+            }
+            remove(RESUME_CHECKPOINT);                                         //finished, nothing to resume
+        }
+    }
+    printf("Resumable transfer: %zu/%zu chunks acknowledged, %zu resent (%zu corrupted)\n", acked, count, resent, corrupted);
+
+    if (checkpoint) {
+        fclose(checkpoint);
+    }
+    Toy_Free(&ctx);
+    Unmap_File(message, mappedLength);
+    free(chunks);
+    free(slots);
+    return ok;
+}
 
 /*============================
-        Sending via ZeroMQ 
+    Merkle Acknowledgement
 ==============================*/
-void Send_via_ZMQ(unsigned char send[], int sendlen)
+//--merkle step 7: one two-part message, [ciphertext][leafSize (uint64) | leaf hashes].
+int Send_With_Leaves_via_ZMQ(unsigned char send[], size_t sendlen, const merkle_tree *tree)
 {
-    void *context = zmq_ctx_new ();					        //creates a socket to talk to Bob
-    void *requester = zmq_socket (context, ZMQ_REQ);		    		//creates requester that sends the messages
+    size_t trailerlen = 8 + tree->leaves * 32;
+    unsigned char *trailer = malloc(trailerlen);
+    uint64_t leafSize = tree->leafSize;
+    memcpy(trailer, &leafSize, 8);
+    memcpy(trailer + 8, tree->hash, tree->leaves * 32);                        //leaves are the first level of the tree
+
+    void *context = zmq_ctx_new();
+    void *requester = zmq_socket(context, ZMQ_REQ);
+    Toy_Send_Deadline(requester, ackTimeout);                                  //a missing Bob fails the send, not hangs it
     printf("Connecting to Bob and sending the message...\n");
-    zmq_connect (requester, "tcp://localhost:5555");		    		//make outgoing connection from socket
-    zmq_send (requester, send, sendlen, 0);			    	    	//send msg to Bob
-    zmq_close (requester);						        //closes the requester socket
-    zmq_ctx_destroy (context);					                //destroys the context & terminates all 0MQ processes
+    zmq_connect(requester, dataEndpoint);
+    zmq_msg_t body, leaves;
+    zmq_msg_init_data(&body, send, sendlen, NULL, NULL);                       //both parts go out without a copy,
+    zmq_msg_init_data(&leaves, trailer, trailerlen, NULL, NULL);               //zmq_ctx_destroy waits until they are sent
+    uint64_t t = Stats_Clock();
+    int sent = zmq_msg_send(&body, requester, ZMQ_SNDMORE) >= 0;
+    if (sent) {
+        sent = zmq_msg_send(&leaves, requester, 0) >= 0;                       //the first part went, so the second has a peer
+    } else {
+        printf("Bob did not take the message within %d ms\n", ackTimeout);
+        zmq_msg_close(&body);
+        zmq_msg_close(&leaves);
+    }
+    zmq_close(requester);
+    zmq_ctx_destroy(context);
+    Stats_Stage(STATS_SEND, t, sendlen + trailerlen);
+    Stats_Count(STATS_MESSAGES_SENT, sent);
+    Stats_Count(STATS_BYTES_SENT, sent ? sendlen + trailerlen : 0);
+    free(trailer);
+    return sent;
 }
 
-/*============================
-        Receiving via ZeroMQ 
-==============================*/
-unsigned char *Receive_via_ZMQ(unsigned char receive[], int *receivelen, int limit) 
+//--merkle steps 8 and 9: Bob answers with [root 32][count uint32][count x leaf index uint64].
+//The roots decide success; on failure the listed leaves are the corrupted byte ranges.
+int Wait_For_Merkle_Ack(void *context, void *receiver, const merkle_tree *tree, size_t messageLength)
 {
-	void *context = zmq_ctx_new ();			        	                                 //creates a socket to talk to Alice
-    void *responder = zmq_socket (context, ZMQ_REP);                                   	//creates responder that receives the messages
-   	int rc = zmq_bind (responder, "tcp://*:5556");	                                	//make outgoing connection from socket
-    int received_length = zmq_recv (responder, receive, limit, 0);	                  	//receive message from Alice
-    unsigned char *temp = (unsigned char*) malloc(received_length);
-    for(int i=0; i<received_length; i++){
-        temp[i] = receive[i];
-    }
-    *receivelen = received_length;
-    //printf("Received Message: %s\n", receive);
-    //printf("Size is %d\n", received_length-1);
-    return temp;
+    printf("Waiting for Merkle acknowledgment from Bob...\n");
+
+    zmq_msg_t ack;
+    size_t received = 0;
+    uint64_t t = Stats_Clock();
+    const unsigned char *body = Ack_Receive(receiver, &ack, &received);
+    Stats_Stage(STATS_ACK_WAIT, t, received);
+    uint32_t count = 0;
+    if (body != NULL && received >= 36) {
+        memcpy(&count, body + 32, 4);
+        if (received < 36 + (size_t)count * 8) {
+            count = 0;
+        }
+    }
+    int acknowledgmentSuccessful = Toy_Ack_Matches(body, received >= 36 ? 32 : 0, Merkle_Root(tree));
+
+    FILE* acknowledgmentFile = fopen("Acknowledgment.txt", "w");
+    if (acknowledgmentFile) {
+        if (acknowledgmentSuccessful) {
+            fprintf(acknowledgmentFile, "Acknowledgment Successful.");
+        } else {
+            fprintf(acknowledgmentFile, "Acknowledgment Failed.");
+            for (uint32_t i = 0; i < count; i++) {
+                uint64_t leaf;
+                memcpy(&leaf, body + 36 + 8 * (size_t)i, 8);
+                uint64_t first = leaf * tree->leafSize;
+                uint64_t last = first + tree->leafSize < messageLength ? first + tree->leafSize : messageLength;
+                fprintf(acknowledgmentFile, "\nCorrupted chunk %llu: bytes %llu-%llu",
+                        (unsigned long long)leaf, (unsigned long long)first, (unsigned long long)last);
+            }
+        }
+        fclose(acknowledgmentFile);
+    } else {
+        printf("Error doing Acknowledgment.txt\n");
+    }
+    if (!acknowledgmentSuccessful) {
+        printf("Merkle roots differ, %u of %zu chunks reported corrupted (see Acknowledgment.txt)\n", count, tree->leaves);
+    }
+
+    if (body) {
+        zmq_msg_close(&ack);
+    }
+    zmq_close(receiver);
+    zmq_ctx_destroy(context);
+    printf("\n");
+    printf("Acknowledgment properly made.\n");
+    return acknowledgmentSuccessful;
 }
+
 //__________________________________________________________________________________________________________________________
@@ -0,0 +1,575 @@
+//////////////
+//   Bench  //
+//////////////
+/***********************************************************************
+ *  Toy Steam Cipher Implementation   *
+ ***********************************************************************
+ *Description:  Micro-benchmarks for every stage of the alice/bob pipeline.
+ 			Each stage runs on its own, for payloads from 32 bytes up to
+ 			--max (factor 32 apart), for at least --time seconds each:
+ 			    prng          PRNG(): pooled buffer + generate the key (step 3)
+ 			    xor           ChaCha20 keystream XOR, one thread
+ 			    xor_parallel  the same on the kernel's thread pool (step 5)
+ 			    sha256        Hash_SHA256() (steps 1 and 6)
+ 			    decrypt_hash  Bob's fused decrypt + SHA-256 (steps 4-6)
+ 			    hex           Hex_Write() of a dump to /dev/null (steps 4 and 6)
+ 			    compress      Compress_Pack(): --compress deflate of a payload
+ 			    zmq_inproc    ZeroMQ round trip, payload out, 32-byte ack back
+ 			    zmq_tcp       the same over loopback TCP
+ 			    e2e_inproc    Alice -> Bob -> ack: hash, encrypt, send, decrypt,
+ 			    e2e_tcp       hash, ack, compare (a Bob thread in this process)
+			Results are one JSON object per line on stdout, so runs can be
+ 			collected and compared over time.
+ 			--selftest runs no benchmark: it checks every ChaCha20 kernel this
+ 			CPU has (forced one at a time with CHACHA_KERNEL, each in its own
+ 			child process) against LibTomCrypt's chacha20_prng_read for each
+ 			SharedSeed*.txt in the test vector directory, and exits 1 on a
+ 			mismatch.
+
+ *Compile:          gcc -O2 bench.c toycipher.c chacha_kernel.c keystream_ring.c merkle.c hex.c stats.c pool.c compress.c writer.c -ltomcrypt -lzmq -lz -lpthread -o bench
+ *                  add -DBENCH_COUNT_ALLOCS -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc to count the
+ *                  allocations made by our own code (libtomcrypt/ZeroMQ internals are not counted)
+ *
+ *Run example:      ./bench                                   (all stages, 32 B .. 32 MiB)
+ *                  ./bench --max 4294967296 --stage xor_parallel --stage decrypt_hash
+ *                  ./bench --time 1 --tcp tcp://127.0.0.1:5599 > bench-$(date +%F).jsonl
+ *                  ./bench --selftest [--vectors "Test Vectors"]
+_______________________________________________________________________________*/
+
+//Header Files
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <glob.h>
+#include <sys/wait.h>
+#include <libtomcrypt/tomcrypt.h>
+#include <zmq.h>
+#include "chacha_kernel.h"
+#include "hex.h"
+#include "session.h"
+#include "toycipher.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define BENCH_MIN_SIZE     32
+#define BENCH_STEP         32                       // next size = size * BENCH_STEP
+#define BENCH_MAX_SIZE     (32u * 1024 * 1024)      // default --max
+#define BENCH_MIN_TIME     0.2                      // default --time, seconds per stage and size
+#define BENCH_INPROC       "inproc://bench"
+#define BENCH_TCP          "tcp://127.0.0.1:5599"   // default --tcp
+#define BENCH_SEED         "bench-seed-0123456789abcdefghij"
+#define BENCH_VECTORS      "Test Vectors"           // default --vectors
+#define SELFTEST_LEN       (3u * 1024 * 1024 + 77)  // keystream bytes compared per seed (not a block multiple)
+#define SELFTEST_MAX_SEEDS 64
+
+//Function prototypes
+static double Now_Seconds(void);
+static unsigned long long Cycles(void);
+static void Bench_Stage(const char *stage, size_t len, double minTime, void (*op)(size_t len));
+static void *Bench_Bob(void *arg);
+static int Bench_Connect(const char *endpoint, int crypto);
+static void Bench_Disconnect(void);
+static int Selftest_Run(const char *vectors);
+static int Selftest_Kernel(const char *kernel, unsigned char *seeds[], int seedLens[], int seedCount);
+
+typedef struct {
+    const char *endpoint;
+    int crypto;                         // 1 = decrypt + hash like Bob, 0 = ack straight back
+    volatile int ready;                 // set once bound
+} bench_bob;
+
+static unsigned char *input, *output;   // --max bytes each
+static toycipher_ctx cipher;
+static FILE *devNull;
+static void *zmqContext, *dealer;
+static pthread_t bobThread;
+static bench_bob bob;
+
+/*============================
+     Allocation Counting
+==============================*/
+#ifdef BENCH_COUNT_ALLOCS
+void *__real_malloc(size_t n);
+void *__real_calloc(size_t count, size_t n);
+void *__real_realloc(void *p, size_t n);
+static unsigned long long benchAllocCount, benchAllocBytes;
+
+void *__wrap_malloc(size_t n)
+{
+    __atomic_fetch_add(&benchAllocCount, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&benchAllocBytes, n, __ATOMIC_RELAXED);
+    return __real_malloc(n);
+}
+
+void *__wrap_calloc(size_t count, size_t n)
+{
+    __atomic_fetch_add(&benchAllocCount, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&benchAllocBytes, count * n, __ATOMIC_RELAXED);
+    return __real_calloc(count, n);
+}
+
+void *__wrap_realloc(void *p, size_t n)
+{
+    __atomic_fetch_add(&benchAllocCount, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&benchAllocBytes, n, __ATOMIC_RELAXED);
+    return __real_realloc(p, n);
+}
+#define ALLOC_COUNT() __atomic_load_n(&benchAllocCount, __ATOMIC_RELAXED)
+#define ALLOC_BYTES() __atomic_load_n(&benchAllocBytes, __ATOMIC_RELAXED)
+#else
+#define ALLOC_COUNT() 0ULL
+#define ALLOC_BYTES() 0ULL
+#endif
+
+/*============================
+          The Stages
+==============================*/
+static void Op_PRNG(size_t len)
+{
+    Pool_Free(PRNG((unsigned char*) BENCH_SEED, sizeof(BENCH_SEED) - 1, len));
+}
+
+static void Op_Xor(size_t len)
+{
+    chacha_kernel_state st = cipher.keystream;
+    Chacha_Kernel_Xor(&st, output, input, len);
+}
+
+static void Op_Xor_Parallel(size_t len)
+{
+    Toy_Encrypt_At(&cipher, 0, output, input, len);
+}
+
+static void Op_SHA256(size_t len)
+{
+    Pool_Free(Hash_SHA256(input, len));
+}
+
+static void Op_Decrypt_Hash(size_t len)
+{
+    hash_state md;
+    unsigned char hash[32];
+    sha256_init(&md);
+    Toy_Decrypt_At(&cipher, 0, output, input, len, &md);
+    sha256_done(&md, hash);
+}
+
+static void Op_Hex(size_t len)
+{
+    Hex_Write(devNull, input, len);
+}
+
+static void Op_Compress(size_t len)
+{
+    unsigned char *packed;
+    Compress_Pack(input, len, &packed);
+    Pool_Free(packed);
+}
+
+//Payload out (zero-copy from input[]), 32-byte ack back. No crypto on either side.
+static void Op_Round_Trip(size_t len)
+{
+    session_header hdr = { SESSION_MAGIC, SESSION_DATA, 0, 0, len };
+    zmq_msg_t payload;
+    unsigned char ack[32];
+    zmq_msg_init_data(&payload, input, len, NULL, NULL);
+    zmq_send(dealer, &hdr, sizeof(hdr), ZMQ_SNDMORE);
+    zmq_msg_send(&payload, dealer, 0);
+    zmq_recv(dealer, &hdr, sizeof(hdr), 0);
+    zmq_recv(dealer, ack, sizeof(ack), 0);
+}
+
+//What alice --session and bob --session do per message: hash and encrypt, send, Bob decrypts
+//and hashes, the ack comes back and is compared.
+static void Op_End_To_End(size_t len)
+{
+    unsigned char digest[32], ack[32];
+    hash_state md;
+    sha256_init(&md);
+    sha256_process(&md, input, len);
+    sha256_done(&md, digest);
+    session_header hdr = { SESSION_MAGIC, SESSION_DATA, 0, 0, len };
+    zmq_msg_t payload;
+    Toy_Msg_Init(&payload, len);
+    Toy_Encrypt_At(&cipher, 0, zmq_msg_data(&payload), input, len);
+    zmq_send(dealer, &hdr, sizeof(hdr), ZMQ_SNDMORE);
+    zmq_msg_send(&payload, dealer, 0);
+    zmq_recv(dealer, &hdr, sizeof(hdr), 0);
+    zmq_recv(dealer, ack, sizeof(ack), 0);
+    if (memcmp(ack, digest, 32) != 0) {
+        printf("Acknowledgment Failed in the end-to-end benchmark\n");
+        exit(1);
+    }
+}
+
+typedef struct {
+    const char *name;
+    void (*op)(size_t len);
+    const char *endpoint;               // ZeroMQ stages: NULL = none, else where Bob binds
+    int crypto;
+} bench_stage;
+
+
+/*************************************************************
+						M A I N
+**************************************************************/
+int main (int argc, char* argv[])
+{
+    size_t maxSize = BENCH_MAX_SIZE;
+    double minTime = BENCH_MIN_TIME;
+    const char *tcpEndpoint = BENCH_TCP;
+    const char *only[16];
+    int onlyCount = 0;
+    const char *vectors = BENCH_VECTORS;
+    int selftest = 0;
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--max") == 0 && a + 1 < argc) {
+            maxSize = strtoull(argv[++a], NULL, 10);
+        } else if (strcmp(argv[a], "--time") == 0 && a + 1 < argc) {
+            minTime = atof(argv[++a]);
+        } else if (strcmp(argv[a], "--tcp") == 0 && a + 1 < argc) {
+            tcpEndpoint = argv[++a];
+        } else if (strcmp(argv[a], "--stage") == 0 && a + 1 < argc && onlyCount < 16) {
+            only[onlyCount++] = argv[++a];
+        } else if (strcmp(argv[a], "--threads") == 0 && a + 1 < argc) {
+            Chacha_Kernel_Threads(atoi(argv[++a]));
+        } else if (strcmp(argv[a], "--selftest") == 0) {
+            selftest = 1;
+        } else if (strcmp(argv[a], "--vectors") == 0 && a + 1 < argc) {
+            vectors = argv[++a];
+        } else {
+            printf("Usage: %s [--max bytes] [--time seconds] [--stage name]... [--tcp endpoint] [--threads n]\n", argv[0]);
+            printf("       %s --selftest [--vectors dir]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (selftest) {
+        return Selftest_Run(vectors);                                          //before anything picks a kernel
+    }
+    if (maxSize < BENCH_MIN_SIZE) {
+        maxSize = BENCH_MIN_SIZE;
+    }
+
+    bench_stage stages[] = {
+        { "prng",         Op_PRNG,         NULL,          0 },
+        { "xor",          Op_Xor,          NULL,          0 },
+        { "xor_parallel", Op_Xor_Parallel, NULL,          0 },
+        { "sha256",       Op_SHA256,       NULL,          0 },
+        { "decrypt_hash", Op_Decrypt_Hash, NULL,          0 },
+        { "hex",          Op_Hex,          NULL,          0 },
+        { "compress",     Op_Compress,     NULL,          0 },
+        { "zmq_inproc",   Op_Round_Trip,   BENCH_INPROC,  0 },
+        { "zmq_tcp",      Op_Round_Trip,   tcpEndpoint,   0 },
+        { "e2e_inproc",   Op_End_To_End,   BENCH_INPROC,  1 },
+        { "e2e_tcp",      Op_End_To_End,   tcpEndpoint,   1 },
+    };
+
+    input = (unsigned char*) malloc(maxSize);
+    output = (unsigned char*) malloc(maxSize);
+    devNull = fopen("/dev/null", "wb");
+    if (input == NULL || output == NULL || devNull == NULL) {
+        printf("Cannot allocate %zu byte buffers\n", maxSize);
+        return 1;
+    }
+    for (size_t i = 0; i < maxSize; i++) {                                     //also faults every page in up front
+        input[i] = (unsigned char)(i * 131 + 7);
+    }
+    memset(output, 0, maxSize);
+    Toy_Init(&cipher, (unsigned char*) BENCH_SEED, sizeof(BENCH_SEED) - 1);
+    zmqContext = zmq_ctx_new();
+    fprintf(stderr, "ChaCha20 kernel: %s, %ld CPUs\n", Chacha_Kernel_Name(), sysconf(_SC_NPROCESSORS_ONLN));
+
+    for (size_t s = 0; s < sizeof(stages) / sizeof(stages[0]); s++) {
+        int wanted = onlyCount == 0;
+        for (int o = 0; o < onlyCount; o++) {
+            wanted |= strcmp(only[o], stages[s].name) == 0;
+        }
+        if (!wanted) {
+            continue;
+        }
+        if (stages[s].endpoint && !Bench_Connect(stages[s].endpoint, stages[s].crypto)) {
+            continue;
+        }
+        for (size_t len = BENCH_MIN_SIZE; len <= maxSize; len *= BENCH_STEP) {
+            Bench_Stage(stages[s].name, len, minTime, stages[s].op);
+            if (len > maxSize / BENCH_STEP) {
+                break;
+            }
+        }
+        if (stages[s].endpoint) {
+            Bench_Disconnect();
+        }
+    }
+
+    Toy_Free(&cipher);
+    zmq_ctx_destroy(zmqContext);
+    fclose(devNull);
+    free(input);
+    free(output);
+    return 0;
+}
+
+/*************************************************************
+					F u n c t i o n s
+**************************************************************/
+/*============================
+          Clocks
+==============================*/
+static double Now_Seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+//Time-stamp counter where there is one; cycles_per_byte is reported as 0 elsewhere.
+static unsigned long long Cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/*============================
+        Run One Stage
+==============================*/
+//One warm-up call, then calls op(len) until at least minTime has passed, and prints a JSON line.
+static void Bench_Stage(const char *stage, size_t len, double minTime, void (*op)(size_t len))
+{
+    op(len);
+    unsigned long long allocs = ALLOC_COUNT(), allocBytes = ALLOC_BYTES();
+    unsigned long long iterations = 0, cycles = Cycles();
+    double started = Now_Seconds(), elapsed;
+    do {
+        op(len);
+        iterations++;
+        elapsed = Now_Seconds() - started;
+    } while (elapsed < minTime);
+    cycles = Cycles() - cycles;
+    allocs = ALLOC_COUNT() - allocs;
+    allocBytes = ALLOC_BYTES() - allocBytes;
+
+    double bytes = (double)len * iterations;
+    char allocsPerOp[32] = "null", allocBytesPerOp[32] = "null";               //null: built without BENCH_COUNT_ALLOCS
+#ifdef BENCH_COUNT_ALLOCS
+    snprintf(allocsPerOp, sizeof(allocsPerOp), "%.2f", (double)allocs / iterations);
+    snprintf(allocBytesPerOp, sizeof(allocBytesPerOp), "%.0f", (double)allocBytes / iterations);
+#endif
+    printf("{\"stage\":\"%s\",\"bytes\":%zu,\"iterations\":%llu,\"seconds\":%.6f,\"mb_per_s\":%.2f,"
+           "\"ns_per_op\":%.1f,\"cycles_per_byte\":%.3f,\"allocs_per_op\":%s,\"alloc_bytes_per_op\":%s,"
+           "\"kernel\":\"%s\"}\n",
+           stage, len, iterations, elapsed, bytes / elapsed / 1e6,
+           elapsed * 1e9 / iterations, cycles / bytes,
+           allocsPerOp, allocBytesPerOp, Chacha_Kernel_Name());
+    fflush(stdout);
+}
+
+/*============================
+        Kernel Selftest
+==============================*/
+//Checks each forced kernel in a child process: the choice is made once per process, so the
+//parent never touches the kernel itself. Returns the exit code for main (0 = all passed).
+static int Selftest_Run(const char *vectors)
+{
+    static const char *kernels[] = { "scalar", "sse2", "avx2", "avx512" };
+    unsigned char *seeds[SELFTEST_MAX_SEEDS];
+    int seedLens[SELFTEST_MAX_SEEDS];
+    int seedCount = 0, failed = 0, tested = 0;
+    char pattern[4096];
+    glob_t found;
+
+    //---1. Read the seeds the way alice and bob do
+    snprintf(pattern, sizeof(pattern), "%s/SharedSeed*.txt", vectors);
+    if (glob(pattern, 0, NULL, &found) != 0 || found.gl_pathc == 0) {
+        printf("No SharedSeed*.txt in \"%s\" (set it with --vectors dir)\n", vectors);
+        return 1;
+    }
+    for (size_t i = 0; i < found.gl_pathc && seedCount < SELFTEST_MAX_SEEDS; i++) {
+        seeds[seedCount] = Read_File(found.gl_pathv[i], &seedLens[seedCount]);
+        seedCount++;
+    }
+    globfree(&found);
+
+    //---2. One child per kernel
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        fflush(stdout);
+        pid_t child = fork();
+        if (child < 0) {
+            printf("Cannot fork for the %s kernel\n", kernels[k]);
+            failed++;
+            continue;
+        }
+        if (child == 0) {
+            setenv("CHACHA_KERNEL", kernels[k], 1);
+            int code = Selftest_Kernel(kernels[k], seeds, seedLens, seedCount);
+            fflush(stdout);                                                    //_exit does not flush
+            _exit(code);
+        }
+        int status;
+        waitpid(child, &status, 0);
+        int code = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+        if (code == 2) {
+            printf("selftest %-7s skipped, not supported by this CPU\n", kernels[k]);
+            continue;
+        }
+        printf("selftest %-7s %s (%d seeds)\n", kernels[k], code == 0 ? "ok" : "FAILED", seedCount);
+        failed += code != 0;
+        tested++;
+    }
+
+    for (int i = 0; i < seedCount; i++) {
+        Pool_Free(seeds[i]);
+    }
+    printf("%d of %d kernels passed\n", tested - failed, tested);
+    return failed == 0 && tested > 0 ? 0 : 1;
+}
+
+//Child side: 0 = every path matched chacha20_prng_read for every seed, 1 = a mismatch,
+//2 = CHACHA_KERNEL did not get us `kernel` (the CPU does not have it).
+static int Selftest_Kernel(const char *kernel, unsigned char *seeds[], int seedLens[], int seedCount)
+{
+    static const size_t pieces[] = { 1, 63, 64, 65, 1000, 4096 + 13 };        //cross block and bulk-width edges
+    if (strcmp(Chacha_Kernel_Name(), kernel) != 0) {
+        return 2;
+    }
+    unsigned char *expect = (unsigned char*) malloc(SELFTEST_LEN);
+    unsigned char *got = (unsigned char*) malloc(SELFTEST_LEN);
+    unsigned char *zero = (unsigned char*) calloc(SELFTEST_LEN, 1);
+    if (expect == NULL || got == NULL || zero == NULL) {
+        printf("Cannot allocate the selftest buffers\n");
+        return 1;
+    }
+    int bad = 0;
+    for (int i = 0; i < seedCount && !bad; i++) {
+        //---1. Reference keystream straight from LibTomCrypt
+        prng_state prng;
+        chacha20_prng_start(&prng);
+        chacha20_prng_add_entropy(seeds[i], seedLens[i], &prng);
+        chacha20_prng_ready(&prng);
+        chacha20_prng_read(expect, SELFTEST_LEN, &prng);
+        chacha20_prng_done(&prng);
+
+        //---2. Sequential calls of odd sizes, so partial blocks carry over between them
+        chacha_kernel_state st;
+        Chacha_Kernel_Init(&st, seeds[i], seedLens[i]);
+        chacha_kernel_state start = st;
+        size_t done = 0;
+        for (int p = 0; done < SELFTEST_LEN; p++) {
+            size_t n = p < (int)(sizeof(pieces) / sizeof(pieces[0])) ? pieces[p] : SELFTEST_LEN - done;
+            if (n > SELFTEST_LEN - done) n = SELFTEST_LEN - done;
+            Chacha_Kernel_Keystream(&st, got + done, n);
+            done += n;
+        }
+        if (memcmp(got, expect, SELFTEST_LEN) != 0) {
+            printf("%s: sequential keystream differs for seed %d\n", kernel, i + 1);
+            bad = 1;
+        }
+
+        //---3. Seek into the middle of a block and XOR from there
+        st = start;
+        Chacha_Kernel_Seek(&st, 12345);
+        Chacha_Kernel_Xor(&st, got, zero, SELFTEST_LEN - 12345);
+        if (memcmp(got, expect + 12345, SELFTEST_LEN - 12345) != 0) {
+            printf("%s: seeked keystream differs for seed %d\n", kernel, i + 1);
+            bad = 1;
+        }
+
+        //---4. The thread pool, which seeks every piece on its own
+        Chacha_Kernel_Xor_Parallel(&start, 0, got, zero, SELFTEST_LEN);
+        if (memcmp(got, expect, SELFTEST_LEN) != 0) {
+            printf("%s: parallel keystream differs for seed %d\n", kernel, i + 1);
+            bad = 1;
+        }
+    }
+    free(expect);
+    free(got);
+    free(zero);
+    return bad;
+}
+
+/*============================
+      In-process Bob
+==============================*/
+//A ROUTER on its own thread standing in for bob --session: every DATA frame is acked with the
+//SHA-256 of its decrypted payload (crypto) or with 32 zero bytes (plain round trip); END stops it.
+static void *Bench_Bob(void *arg)
+{
+    bench_bob *b = (bench_bob*) arg;
+    void *router = zmq_socket(zmqContext, ZMQ_ROUTER);
+    if (zmq_bind(router, b->endpoint) != 0) {
+        printf("Cannot bind %s: %s\n", b->endpoint, zmq_strerror(zmq_errno()));
+        zmq_close(router);
+        __atomic_store_n(&b->ready, -1, __ATOMIC_RELEASE);
+        return NULL;
+    }
+    __atomic_store_n(&b->ready, 1, __ATOMIC_RELEASE);
+    for (;;) {
+        zmq_msg_t identity, payload;
+        session_header hdr;
+        zmq_msg_init(&identity);
+        zmq_msg_init(&payload);
+        zmq_msg_recv(&identity, router, 0);
+        zmq_recv(router, &hdr, sizeof(hdr), 0);
+        if (hdr.type == SESSION_END) {
+            zmq_msg_send(&identity, router, ZMQ_SNDMORE);
+            zmq_send(router, &hdr, sizeof(hdr), 0);
+            zmq_msg_close(&payload);
+            break;
+        }
+        zmq_msg_recv(&payload, router, 0);
+        unsigned char hash[32] = {0};
+        if (b->crypto) {
+            hash_state md;
+            sha256_init(&md);
+            Toy_Decrypt_At(&cipher, hdr.offset, zmq_msg_data(&payload), zmq_msg_data(&payload), zmq_msg_size(&payload), &md);
+            sha256_done(&md, hash);
+        }
+        hdr.type = SESSION_ACK;
+        zmq_msg_send(&identity, router, ZMQ_SNDMORE);
+        zmq_send(router, &hdr, sizeof(hdr), ZMQ_SNDMORE);
+        zmq_send(router, hash, sizeof(hash), 0);
+        zmq_msg_close(&payload);
+    }
+    zmq_close(router);
+    return NULL;
+}
+
+//Starts Bench_Bob on endpoint and connects the benchmark's DEALER to it. Returns 1 on success.
+static int Bench_Connect(const char *endpoint, int crypto)
+{
+    bob.endpoint = endpoint;
+    bob.crypto = crypto;
+    bob.ready = 0;
+    if (pthread_create(&bobThread, NULL, Bench_Bob, &bob) != 0) {
+        return 0;
+    }
+    int ready;
+    while ((ready = __atomic_load_n(&bob.ready, __ATOMIC_ACQUIRE)) == 0) {     //inproc needs the bind before the connect
+        usleep(1000);
+    }
+    if (ready < 0) {
+        pthread_join(bobThread, NULL);
+        return 0;
+    }
+    dealer = zmq_socket(zmqContext, ZMQ_DEALER);
+    zmq_connect(dealer, endpoint);
+    return 1;
+}
+
+static void Bench_Disconnect(void)
+{
+    session_header end = { SESSION_MAGIC, SESSION_END, 0, 0, 0 };
+    zmq_send(dealer, &end, sizeof(end), 0);
+    zmq_recv(dealer, &end, sizeof(end), 0);
+    pthread_join(bobThread, NULL);
+    int linger = 0;
+    zmq_setsockopt(dealer, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_close(dealer);
+}
+//__________________________________________________________________________________________________________________________
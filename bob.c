@@ -15,9 +15,28 @@
  * 
  * 
  *
- *Compile:          gcc bob.c -ltomcrypt -lzmq -o bob
+ *Compile:          gcc bob.c toycipher.c chacha_kernel.c keystream_ring.c merkle.c hex.c stats.c pool.c compress.c writer.c -ltomcrypt -lzmq -lz -lpthread -o bob
+ *                  (or against the library: gcc bob.c -L. -ltoycipher -ltomcrypt -lzmq -lz -lpthread -o bob, see toycipher.h)
  *
- *Run:              ./bob
+ *Run:              ./bob SharedSeed1.txt
+ *                  ./bob SharedSeed1.txt --stream        (pairs with alice --stream)
+ *                  ./bob SharedSeed1.txt --threads 8     (parallel keystream XOR)
+ *                  ./bob SharedSeed1.txt --binary | --no-dumps   (Hash as .bin, or not at all)
+ *                  ./bob SharedSeed1.txt --endpoint ipc:///tmp/bob.sock --ack-endpoint ipc:///tmp/alice.sock
+ *                                                        (same endpoints on alice; default tcp 5555/5556)
+ *                  ./bob SharedSeed1.txt --session       (pairs with alice --session)
+ *                  ./bob SharedSeed1.txt --session --prefetch 4194304   (keystream ready before the message arrives)
+ *                  ./bob SharedSeed1.txt --merkle        (pairs with alice --merkle, chunked tree ack)
+ *                  ./bob SharedSeed1.txt --resume        (pairs with alice --resume, may be restarted mid-transfer)
+ *                  ./bob Manifest.txt --batch            (pairs with alice Manifest.txt --batch; a directory works too)
+ *                  ./bob SharedSeed1.txt --server [--workers 8] [--report 5]
+ *                                                        (daemon: any number of alice --session clients)
+ *                  ./bob SharedSeed1.txt --server --stats-endpoint tcp://127.0.0.1:5557
+ *                                                        (any REQ to 5557 gets the live per-step stats as JSON)
+ *                  ./bob SharedSeed1.txt --stats stats.json   (any mode: per-step stats written on exit)
+ *                  ./bob SharedSeed1.txt --writer threads --durable
+ *                                                        (Hash/Plaintext writes: io_uring (default), threads or sync;
+ *                                                         --durable fdatasyncs them before exit)
  *
  *Documentation:    Libtomcrypt Manual Chapter 8 section 1
  *
@@ -27,17 +46,76 @@ _______________________________________________________________________________*
 //Header Files
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <libtomcrypt/tomcrypt.h>
 #include <zmq.h>
+#include "chacha_kernel.h"
+#include "session.h"
+#include "merkle.h"
+#include "hex.h"
+#include "toycipher.h"
 
 //Function prototypes
-unsigned char* Read_File (char fileName[], int *fileLen);
-unsigned char* PRNG(unsigned char *seed, unsigned long seedlen, unsigned long prnlen);
-unsigned char* Hash_SHA256(unsigned char input[], unsigned long inputlen);
-void Show_in_Hex (char name[], unsigned char hex[], int hexlen);
-unsigned char *Receive_via_ZMQ(unsigned char receive[], int *receivelen, int limit);
-void Send_via_ZMQ(unsigned char send[], int sendlen);
-int writeHexToFile(const char* fileName, unsigned char* data, int length);
+long long Stream_Receive_Decrypt(unsigned char *seed, unsigned long seedlen, unsigned char digest[32]);
+long long Session_Serve(unsigned char *seed, unsigned long seedlen);
+long long Merkle_Receive_Decrypt(unsigned char *seed, unsigned long seedlen);
+long long Resume_Serve(unsigned char *seed, unsigned long seedlen);
+long long Batch_Serve(const toy_batch_pair *pairs, size_t count);
+unsigned char *Session_Inflate(const session_header *hdr, const unsigned char *data, unsigned char hash[32], uint64_t limit);
+void Session_Release_Payload(void *data, void *hint);
+int Session_Mark_Seen(unsigned char **seen, size_t *seenBytes, uint64_t seq);
+
+typedef struct server_job {
+    zmq_msg_t identity;                 // ROUTER identity of the client, sent back with the ack
+    zmq_msg_t payload;                  // ciphertext, decrypted in place by the worker
+    session_header hdr;
+    int envelope;                       // 1 = REQ client: its frames and our reply carry an empty delimiter
+    struct server_job *next, *prev;
+} server_job;
+
+typedef struct {
+    pthread_mutex_t lock;
+    server_job *head, *tail;            // owner takes the head, thieves take the tail
+    size_t queuedBytes;                 // written under lock, read without it: __atomic only
+} server_deque;
+
+typedef struct {
+    void *context;
+    server_deque *deques;               // one per worker
+    int workers;
+    sem_t pending;                      // jobs queued across all deques
+    volatile int stopping;
+    const toycipher_ctx *cipher;        // shared by the workers, only used through Toy_Decrypt_At
+    unsigned long long messages, bytes; // updated atomically by the workers
+} server_pool;
+
+typedef struct {
+    int id;
+    pthread_t thread;
+    server_pool *pool;
+} server_worker;
+
+int Server_Run(unsigned char *seed, unsigned long seedlen, int workers, int reportSeconds);
+
+#define SERVER_RESULTS_ENDPOINT "inproc://bob-results"
+
+#define STREAM_HWM        8             // chunks ZeroMQ may queue on our side before Alice is held back
+#define FUSED_BLOCK       (64 * 1024)   // read-back granularity when rehashing Plaintext.txt
+
+static int dumpMode = DUMP_HEX;         // Hash dump: hex (default), --binary or --no-dumps
+static const char *dataEndpoint = SESSION_ENDPOINT_BIND;      // --endpoint: where Bob listens (tcp://, ipc://, inproc://)
+static const char *ackEndpoint = ACK_ENDPOINT_CONNECT;        // --ack-endpoint: where Alice waits for acks
+static size_t prefetchBytes = 0;        // --prefetch: keystream kept ready ahead by a background thread, 0 = off
+static const char *statsEndpoint = NULL;                      // --stats-endpoint: --server answers any request there with its stats
+static int writerBackend = WRITER_AUTO; // --writer: how artifact files are written (writer.c)
+static int durable = 0;                 // --durable: artifact files reach the disk before Bob exits
+static size_t resumeChunk = RESUME_CHUNK_SIZE;                // --chunk: Alice's --resume chunk size, the most a chunk inflates to
 
 
 /*************************************************************
@@ -45,18 +123,168 @@ int writeHexToFile(const char* fileName, unsigned char* data, int length);
 **************************************************************/
 int main (int argc, char* argv[])
 {   
+    if (argc < 2) {
+        printf("Usage: %s SharedSeed.txt [--stream | --session | --merkle | --resume] [--threads n] [--binary | --no-dumps]\n"
+               "       %s SharedSeed.txt --session | --stream [--prefetch bytes]\n"
+               "       %s SharedSeed.txt --resume [--chunk bytes]   (same --chunk as Alice)\n"
+               "       %s Manifest.txt|Directory --batch\n"
+               "       %s SharedSeed.txt --server [--workers n] [--report seconds] [--stats-endpoint tcp://*:5557]\n"
+               "  any mode: [--endpoint tcp://*:5555 | ipc:///tmp/bob.sock] [--ack-endpoint tcp://localhost:5556 | ipc:///tmp/alice.sock]\n"
+               "            [--stats stats.json | -] [--writer auto|uring|threads|sync] [--durable]\n",
+               argv[0], argv[0], argv[0], argv[0], argv[0]);
+        return 1;
+    }
+    int streamMode = 0, sessionMode = 0, serverMode = 0, merkleMode = 0, resumeMode = 0, batchMode = 0;
+    int workers = 0, reportSeconds = 5;
+    for (int a = 2; a < argc; a++) {
+        if (strcmp(argv[a], "--stream") == 0) {
+            streamMode = 1;
+        } else if (strcmp(argv[a], "--session") == 0) {
+            sessionMode = 1;
+        } else if (strcmp(argv[a], "--server") == 0) {
+            serverMode = 1;
+        } else if (strcmp(argv[a], "--merkle") == 0) {
+            merkleMode = 1;
+        } else if (strcmp(argv[a], "--resume") == 0) {
+            resumeMode = 1;
+        } else if (strcmp(argv[a], "--batch") == 0) {
+            batchMode = 1;
+        } else if (strcmp(argv[a], "--endpoint") == 0 && a + 1 < argc) {
+            dataEndpoint = argv[++a];
+        } else if (strcmp(argv[a], "--ack-endpoint") == 0 && a + 1 < argc) {
+            ackEndpoint = argv[++a];
+        } else if (strcmp(argv[a], "--binary") == 0) {
+            dumpMode = DUMP_BINARY;
+        } else if (strcmp(argv[a], "--no-dumps") == 0) {
+            dumpMode = DUMP_NONE;
+        } else if (strcmp(argv[a], "--workers") == 0 && a + 1 < argc) {
+            workers = atoi(argv[++a]);                                          // default: one per CPU
+        } else if (strcmp(argv[a], "--report") == 0 && a + 1 < argc) {
+            reportSeconds = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--threads") == 0 && a + 1 < argc) {
+            Chacha_Kernel_Threads(atoi(argv[++a]));                             // default: one per CPU
+        } else if (strcmp(argv[a], "--prefetch") == 0 && a + 1 < argc) {
+            prefetchBytes = strtoul(argv[++a], NULL, 10);                       // --stream and --session
+        } else if (strcmp(argv[a], "--stats") == 0 && a + 1 < argc) {
+            Stats_Write_At_Exit(argv[++a], "bob");                              // per-step timings as JSON when we exit
+        } else if (strcmp(argv[a], "--stats-endpoint") == 0 && a + 1 < argc) {
+            statsEndpoint = argv[++a];                                          // --server: live stats on request
+        } else if (strcmp(argv[a], "--writer") == 0 && a + 1 < argc && Writer_Parse_Backend(argv[a + 1]) >= 0) {
+            writerBackend = Writer_Parse_Backend(argv[++a]);
+        } else if (strcmp(argv[a], "--durable") == 0) {
+            durable = 1;
+        } else if (strcmp(argv[a], "--chunk") == 0 && a + 1 < argc) {
+            resumeChunk = strtoul(argv[++a], NULL, 10);                         // --resume
+        } else {
+            printf("Unknown option: %s\n", argv[a]);
+            return 1;
+        }
+    }
+    Writer_Start(writerBackend, durable);                                       //Hash/Plaintext writes leave the ack path
+
+// ---Server mode: long-running daemon, many Alice sessions at once, decryption on a worker pool.
+    if (serverMode) {
+        int seed_length = 0;
+        unsigned char* seed = Read_File(argv[1], &seed_length); // "SharedSeed.txt"
+        int status = Server_Run(seed, seed_length, workers, reportSeconds);
+        Pool_Free(seed);
+        return status;
+    }
+
+// ---Session mode: stay bound and answer every message Alice sends until she ends the session.
+    if (sessionMode) {
+        int seed_length = 0;
+        unsigned char* seed = Read_File(argv[1], &seed_length); // "SharedSeed.txt"
+        printf("Waiting for a session from Alice...\n");
+        long long served = Session_Serve(seed, seed_length);
+        Pool_Free(seed);
+        printf("Session closed after %lld messages.\n", served);
+        if (!Writer_Finish()) {
+            served = -1;
+        }
+        printf("==============The End========================\n");
+        return served < 0 ? 1 : 0;
+    }
+
+// ---Batch mode: argv[1] is the manifest (or directory) Alice uses; every pair's seed is keyed up front.
+    if (batchMode) {
+        toy_batch_pair *pairs = NULL;
+        size_t count = Toy_Batch_Load(argv[1], &pairs);
+        if (count == 0) {
+            return 1;
+        }
+        printf("Waiting for a batch of %zu pairs from Alice...\n", count);
+        long long served = Batch_Serve(pairs, count);
+        free(pairs);
+        printf("==============The End========================\n");
+        return served < 0 ? 1 : 0;
+    }
+
+// ---Resumable mode: chunks land at their own offset in Plaintext.txt, in any order, as often as Alice resends them.
+    if (resumeMode) {
+        int seed_length = 0;
+        unsigned char* seed = Read_File(argv[1], &seed_length); // "SharedSeed.txt"
+        printf("Waiting for chunks from Alice...\n");
+        long long total = Resume_Serve(seed, seed_length);
+        Pool_Free(seed);
+        if (total >= 0) {
+            printf("Transfer complete, Plaintext.txt is %lld bytes\n", total);
+        }
+        printf("==============The End========================\n");
+        return total < 0 ? 1 : 0;
+    }
+
+// ---Merkle mode: whole message in one go, acknowledged with a chunked hash tree instead of one SHA-256.
+    if (merkleMode) {
+        int seed_length = 0;
+        unsigned char* seed = Read_File(argv[1], &seed_length); // "SharedSeed.txt"
+        printf("Waiting for ciphertext and leaf hashes from Alice...\n");
+        long long total = Merkle_Receive_Decrypt(seed, seed_length);
+        Pool_Free(seed);
+        printf("==============The End========================\n");
+        return total < 0 ? 1 : 0;
+    }
+
+// ---Streaming mode: receive, decrypt, write and hash chunk by chunk, then ack as usual.
+    if (streamMode) {
+        int seed_length = 0;
+        unsigned char* seed = Read_File(argv[1], &seed_length); // "SharedSeed.txt"
+        unsigned char hash[32];
+        printf("Waiting for streamed ciphertext from Alice...\n");
+        long long total = Stream_Receive_Decrypt(seed, seed_length, hash);
+        Pool_Free(seed);
+        if (total < 0) {
+            return 1;
+        }
+        printf("Decrypted %lld bytes into Plaintext.txt\n", total);
+        Writer_Track("Plaintext.txt");
+        if (dumpMode != DUMP_NONE && Writer_Dump("Hash", hash, 32, dumpMode, NULL, NULL)) {
+            printf("Hash queued for Hash%s.\n", DUMP_EXTENSION(dumpMode));
+        }
+        Send_via_ZMQ(ackEndpoint, hash, 32, 0);
+        printf("Acknowledgment sent to Alice via ZeroMQ.\n");
+        int written = Writer_Finish();                                         //hash is on our stack
+        printf("==============The End========================\n");
+        return written ? 0 : 1;
+    }
 
 // ---1. Bob receives ciphertext from Alice via ZeroMQ.
     void* context = zmq_ctx_new();
     void* responder = zmq_socket(context, ZMQ_REP); // Create a reply socket to receive ciphertext
-    zmq_bind(responder, "tcp://*:5555");           // Binding to the port
+    zmq_bind(responder, dataEndpoint);             // Binding to the port (tcp://*:5555 unless --endpoint)
     printf("Waiting for ciphertext from Alice...\n");
 
-    int max_ciphertext_length = 1024; // Maximum expected ciphertext size (adjust as needed)
-    unsigned char receivedCiphertext[max_ciphertext_length];
-    
-    // Receive the ciphertext
-    int received_length = zmq_recv(responder, receivedCiphertext, max_ciphertext_length, 0);
+    // Receive the ciphertext: ZeroMQ sizes the message, so there is no length cap and no copy
+    zmq_msg_t ciphertextMsg;
+    size_t received_length = 0;
+    uint64_t t = Stats_Clock();
+    unsigned char* receivedCiphertext = Receive_via_ZMQ(responder, &ciphertextMsg, &received_length);
+    if (receivedCiphertext == NULL) {
+        return 1;
+    }
+    Stats_Stage(STATS_RECEIVE, t, received_length);
+    Stats_Count(STATS_MESSAGES_RECEIVED, 1);
+    Stats_Count(STATS_BYTES_RECEIVED, received_length);
 
 
     // ---2. Bob reads shared seed from "SharedSeed.txt" file.
@@ -70,44 +298,51 @@ int main (int argc, char* argv[])
     // ---3. Bob generates the secret key based on PRNG (ChaCha20).
     printf("Calling the PRNG function . . .\n");
     unsigned char* key = PRNG(seed, seed_length, seed_length); // Assuming a 32-byte key
-    Show_in_Hex("Generated Key", key, seed_length); // Adjust size accordingly
-    printf("\n==================================================\n");
-
-    // ---4. Bob XORs received ciphertext with the secret key to obtain plaintext.
-    //int ciphertext_length = 32; // Adjust size accordingly
-    size_t ciphertext_length = received_length;
-    //printf("Size of receivedCiphertext array: %zu\n", ciphertext_length);
-    
-    unsigned char* plaintext = malloc(ciphertext_length); // Adjust size accordingly
-    for (int i = 0; i < ciphertext_length; i++) {
-        plaintext[i] = receivedCiphertext[i] ^ key[i];
+    if (dumpMode != DUMP_NONE) {
+        Show_in_Hex("Generated Key", key, seed_length); // Adjust size accordingly
     }
     printf("\n==================================================\n");
 
-    // ---5. Bob writes decrypted plaintext in a file named "Plaintext.txt".
-    FILE* plaintxtFile = fopen("Plaintext.txt", "wb");
-    if (plaintxtFile) {
-        fwrite(plaintext, 1, ciphertext_length, plaintxtFile); // Adjust size accordingly
-        fclose(plaintxtFile);
-        printf("plaintext written successfully\n");
-    } else {
-        printf("Error writing Plaintext.txt\n");
+    // ---4/5/6. Bob decrypts, writes "Plaintext.txt" and hashes in a single pass.
+    // Plaintext.txt is sized up front and mapped, so each block is XORed straight into
+    // the file's pages and fed to SHA-256 while it is still in cache: no separate plaintext
+    // buffer, no fwrite copy, and no second walk over the message to hash it.
+    size_t ciphertext_length = received_length;
+    unsigned char hash[32];
+    toycipher_ctx cipher;
+    Toy_Init(&cipher, seed, seed_length);
+    unsigned char* plaintext = Map_Output_File("Plaintext.txt", ciphertext_length);
+    if (plaintext == NULL) {
+        return 1;
     }
- 
-
-    // ---6. Bob hashes plaintext with SHA-256 and places it in a file named "Hash.txt".
-    unsigned char* hash = Hash_SHA256(plaintext, ciphertext_length); // Adjust size accordingly
-    if (writeHexToFile("Hash.txt", hash, 32)) {
-        printf("Hash written to Hash.txt successfully.\n");
+    Toy_Decrypt_Update(&cipher, plaintext, receivedCiphertext, ciphertext_length);
+    Toy_Finish(&cipher, hash);
+    Toy_Free(&cipher);
+    Pool_Free(key);                                                            //only needed for the step 3 printout
+    Pool_Free(seed);
+    Unmap_Output_File(plaintext, ciphertext_length);
+    Writer_Track("Plaintext.txt");                                             //--durable flushes it before exit
+    printf("plaintext written successfully\n");
+    zmq_msg_close(&ciphertextMsg);
+    zmq_close(responder);
+    zmq_ctx_destroy(context);
+    // The Hash dump is queued to the background writer, so the ack below does not wait for the disk.
+    if (dumpMode == DUMP_NONE) {
+        printf("Hash dump skipped.\n");
+    } else if (Writer_Dump("Hash", hash, 32, dumpMode, NULL, NULL)) {
+        printf("Hash queued for Hash%s.\n", DUMP_EXTENSION(dumpMode));
     } else {
-        printf("Failed to write the Hash to Hash.txt.\n");
+        printf("Failed to write the Hash to Hash%s.\n", DUMP_EXTENSION(dumpMode));
     }    
     printf("\n==================================================\n");
 
     // ---7. Bob sends the hash over ZeroMQ to Alice as acknowledgment.
-    Send_via_ZMQ(hash, 32); // SHA-256 hash size is 32 bytes
+    Send_via_ZMQ(ackEndpoint, hash, 32, 0); // SHA-256 hash size is 32 bytes
     printf("Acknowledgment sent to Alice via ZeroMQ.\n");
 
+    if (!Writer_Finish()) {                                                    //hash is on our stack
+        return 1;
+    }
     printf("==============The End========================\n");
 
     return 0;
@@ -118,128 +353,849 @@ int main (int argc, char* argv[])
 /*************************************************************
 					F u n c t i o n s
 **************************************************************/
-//converts to readable format in files.
-int writeHexToFile(const char* fileName, unsigned char* data, int length) {
-    FILE* file = fopen(fileName, "w");
-    if (file == NULL) {
-        printf("Error opening file for w.");
-        return 0;
+/*============================
+     Streaming Decryption
+==============================*/
+//Counterpart of Alice's --stream mode. Each ZeroMQ message is one chunk of ciphertext;
+//it is XORed with the next piece of keystream, appended to Plaintext.txt and fed into
+//the running SHA-256 before the next chunk is taken off the socket. ZeroMQ keeps
+//receiving into its own queue (capped at STREAM_HWM chunks) while we write to disk.
+//An empty message ends the stream. Returns the number of bytes decrypted.
+long long Stream_Receive_Decrypt(unsigned char *seed, unsigned long seedlen, unsigned char digest[32])
+{
+    FILE *out = fopen("Plaintext.txt", "wb");
+    if (out == NULL) {
+        printf("Error writing Plaintext.txt\n");
+        return -1;
     }
 
-    for (int i = 0; i < length; i++) {
-        fprintf(file, "%02x", data[i]);
+    toycipher_ctx ctx;                                                         //one context for the whole stream: keystream and hash advance per chunk
+    Toy_Init(&ctx, seed, seedlen);
+    if (prefetchBytes > 0) {
+        Toy_Prefetch(&ctx, prefetchBytes);
     }
+    void *puller = Toy_Socket(&ctx, ZMQ_PULL);
+    int hwm = STREAM_HWM;
+    zmq_setsockopt(puller, ZMQ_RCVHWM, &hwm, sizeof(hwm));
+    zmq_bind(puller, dataEndpoint);
 
-    fclose(file);
-    return 1;
+    long long total = 0;
+    zmq_msg_t chunk;
+    for (;;) {
+        zmq_msg_init(&chunk);
+        uint64_t t = Stats_Clock();
+        if (zmq_msg_recv(&chunk, puller, 0) < 0) {
+            printf("Receive error: %s\n", zmq_strerror(zmq_errno()));
+            zmq_msg_close(&chunk);
+            total = -1;
+            break;
+        }
+        size_t n = zmq_msg_size(&chunk);
+        Stats_Stage(STATS_RECEIVE, t, n);
+        if (n == 0) {                                                          //end of stream
+            Stats_Count(STATS_MESSAGES_RECEIVED, 1);                           //the whole stream is one message
+            zmq_msg_close(&chunk);
+            break;
+        }
+        Stats_Count(STATS_BYTES_RECEIVED, n);
+        unsigned char *data = (unsigned char*) zmq_msg_data(&chunk);
+        Toy_Decrypt_Update(&ctx, data, data, n);                               //in place, hashed while still in cache
+        t = Stats_Clock();
+        fwrite(data, 1, n, out);
+        Stats_Stage(STATS_WRITE, t, n);
+        total += n;
+        zmq_msg_close(&chunk);
+    }
+    Toy_Finish(&ctx, digest);
+
+    Toy_Free(&ctx);
+    fclose(out);
+    return total;
+}
+
+/*============================
+      Resumable Transfer
+==============================*/
+//Bob's side of --resume. Every DATA frame is one chunk: it is decrypted at its keystream
+//offset, hashed, and pwrite()n at the same offset of Plaintext.txt, then acked with its hash.
+//Plaintext.txt is not truncated on start, so when Bob is restarted the chunks Alice has already
+//had acked are still on disk and she only sends the rest. Chunks may arrive out of order or
+//more than once; a resend simply overwrites the old bytes. END carries the message length in
+//`offset`: the file is trimmed to it, flushed, hashed and the hash sent back (and written to
+//Hash.txt). Returns the final length, or -1.
+long long Resume_Serve(unsigned char *seed, unsigned long seedlen)
+{
+    toycipher_ctx ctx;
+    Toy_Init(&ctx, seed, seedlen);
+
+    int fd = open("Plaintext.txt", O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        printf("Error opening Plaintext.txt\n");
+        return -1;
+    }
+    void *router = Toy_Socket(&ctx, ZMQ_ROUTER);
+    zmq_bind(router, dataEndpoint);
+
+    long long total = -1, chunks = 0;
+    for (;;) {
+        zmq_msg_t identity, header, payload;
+        zmq_msg_init(&identity);
+        zmq_msg_init(&header);
+        zmq_msg_init(&payload);
+        uint64_t t = Stats_Clock();
+        if (zmq_msg_recv(&identity, router, 0) < 0 || zmq_msg_recv(&header, router, 0) < 0) {
+            printf("Receive error: %s\n", zmq_strerror(zmq_errno()));
+            break;
+        }
+        if (zmq_msg_more(&header)) {
+            zmq_msg_recv(&payload, router, 0);
+        }
+        Stats_Stage(STATS_RECEIVE, t, zmq_msg_size(&payload));
+        Stats_Count(STATS_MESSAGES_RECEIVED, 1);
+        Stats_Count(STATS_BYTES_RECEIVED, zmq_msg_size(&payload));
+        session_header hdr;
+        int valid = zmq_msg_size(&header) == sizeof(hdr);
+        if (valid) {
+            memcpy(&hdr, zmq_msg_data(&header), sizeof(hdr));
+            valid = hdr.magic == SESSION_MAGIC;
+        }
+
+        if (valid && hdr.type == SESSION_END) {
+            unsigned char hash[32];
+            hash_state md;
+            unsigned char *block = Pool_Alloc(FUSED_BLOCK);
+            ssize_t n;
+            total = (long long)hdr.offset;
+            if (ftruncate(fd, (off_t)total) != 0 || fdatasync(fd) != 0) {
+                printf("Error finishing Plaintext.txt\n");
+            }
+            sha256_init(&md);
+            for (off_t at = 0; (n = pread(fd, block, FUSED_BLOCK, at)) > 0; at += n) {
+                sha256_process(&md, block, (unsigned long)n);
+            }
+            sha256_done(&md, hash);
+            Pool_Free(block);
+            if (dumpMode != DUMP_NONE && Dump_File("Hash", hash, 32, dumpMode)) {
+                printf("Hash written to Hash%s successfully.\n", DUMP_EXTENSION(dumpMode));
+            }
+            zmq_msg_send(&identity, router, ZMQ_SNDMORE);
+            zmq_send(router, &hdr, sizeof(hdr), ZMQ_SNDMORE);
+            zmq_send(router, hash, sizeof(hash), 0);
+            zmq_msg_close(&header);
+            zmq_msg_close(&payload);
+            break;
+        }
+        if (valid && hdr.type == SESSION_DATA && hdr.length == zmq_msg_size(&payload)) {
+            unsigned char *data = (unsigned char*) zmq_msg_data(&payload);
+            unsigned char *plain = data, *inflated = NULL;
+            size_t plainLength = hdr.length;
+            unsigned char hash[32];
+            if (hdr.flags & SESSION_DEFLATE) {
+                Toy_Decrypt_At(&ctx, hdr.offset, data, data, hdr.length, NULL);
+                plain = inflated = Session_Inflate(&hdr, data, hash, resumeChunk);   //a bad chunk is acked with a hash that cannot match
+                plainLength = inflated ? hdr.plain : 0;
+            } else {
+                hash_state md;
+                sha256_init(&md);
+                Toy_Decrypt_At(&ctx, hdr.offset, data, data, hdr.length, &md);
+                sha256_done(&md, hash);
+            }
+            uint64_t w = Stats_Clock();
+            ssize_t written = plain ? pwrite(fd, plain, plainLength, (off_t)hdr.offset) : 0;
+            Stats_Stage(STATS_WRITE, w, plainLength);
+            Pool_Free(inflated);
+            if (written != (ssize_t)plainLength) {
+                printf("Error writing chunk %llu, not acknowledging it\n", (unsigned long long)hdr.seq);
+                zmq_msg_close(&identity);
+            } else {
+                session_header ack = { SESSION_MAGIC, SESSION_ACK, hdr.seq, hdr.offset, sizeof(hash) };
+                zmq_msg_send(&identity, router, ZMQ_SNDMORE);
+                zmq_send(router, &ack, sizeof(ack), ZMQ_SNDMORE);
+                zmq_send(router, hash, sizeof(hash), 0);
+                chunks++;
+            }
+        } else {
+            printf("Dropping malformed frame\n");
+            zmq_msg_close(&identity);
+        }
+        zmq_msg_close(&header);
+        zmq_msg_close(&payload);
+    }
+    printf("%lld chunks received\n", chunks);
+
+    Toy_Free(&ctx);
+    close(fd);
+    return total;
 }
+
 /*============================
-        Read from File
+     Merkle Acknowledgement
 ==============================*/
-unsigned char* Read_File (char fileName[], int *fileLen)
+//Counterpart of Alice's --merkle mode. The message arrives as [ciphertext][leafSize | leaf hashes].
+//Bob decrypts it in place on the kernel's thread pool, builds his own tree over the plaintext with
+//one hashing thread per CPU, and rebuilds Alice's tree from her leaves. The ack is
+//    [Bob's root 32][count uint32][count x leaf index uint64]
+//where the indices are the leaves under every subtree whose hashes differ, found by walking
+//both trees from the root (at most MERKLE_MAX_REPORT of them). Hash.txt holds the root.
+//Returns the number of bytes decrypted, or -1.
+long long Merkle_Receive_Decrypt(unsigned char *seed, unsigned long seedlen)
 {
-    FILE *pFile;
-	pFile = fopen(fileName, "r");
-	if (pFile == NULL)
-	{
-		printf("Error opening file.\n");
-		exit(0);
-	}
-    fseek(pFile, 0L, SEEK_END);
-    int temp_size = ftell(pFile)+1;
-    fseek(pFile, 0L, SEEK_SET);
-    unsigned char *output = (unsigned char*) malloc(temp_size);
-	fgets(output, temp_size, pFile);
-	fclose(pFile);
-
-    *fileLen = temp_size-1;
-	return output;
+    void *context = zmq_ctx_new();
+    void *responder = zmq_socket(context, ZMQ_REP);
+    zmq_bind(responder, dataEndpoint);
+
+    zmq_msg_t body, trailer;
+    zmq_msg_init(&body);
+    zmq_msg_init(&trailer);
+    int more = 0;
+    size_t moreSize = sizeof(more);
+    if (zmq_msg_recv(&body, responder, 0) < 0
+        || zmq_getsockopt(responder, ZMQ_RCVMORE, &more, &moreSize) != 0 || !more
+        || zmq_msg_recv(&trailer, responder, 0) < 8) {
+        printf("Expected [ciphertext][leaf hashes] from alice --merkle\n");
+        zmq_msg_close(&body);
+        zmq_msg_close(&trailer);
+        zmq_close(responder);
+        zmq_ctx_destroy(context);
+        return -1;
+    }
+
+    unsigned char *data = (unsigned char*) zmq_msg_data(&body);
+    size_t len = zmq_msg_size(&body);
+    const unsigned char *leafData = (const unsigned char*) zmq_msg_data(&trailer);
+    uint64_t leafSize;
+    memcpy(&leafSize, leafData, 8);
+    size_t theirLeaves = (zmq_msg_size(&trailer) - 8) / 32;
+
+    toycipher_ctx cipher;
+    Toy_Init(&cipher, seed, seedlen);
+    unsigned char *plaintext = Map_Output_File("Plaintext.txt", len);          //decrypted straight into the file's pages
+    if (plaintext == NULL) {
+        plaintext = data;                                                      //still answer Alice, just without the file
+    }
+    Toy_Decrypt_At(&cipher, 0, plaintext, data, len, NULL);                   //no running hash: the thread pool does the XOR
+    Toy_Free(&cipher);
+
+    merkle_tree mine, theirs;
+    Merkle_Build(&mine, plaintext, len, leafSize, 0);
+    int haveTheirs = Merkle_From_Leaves(&theirs, (const unsigned char (*)[32])(leafData + 8), theirLeaves, leafSize);
+
+    if (plaintext != data) {
+        Unmap_Output_File(plaintext, len);
+        Writer_Track("Plaintext.txt");
+        printf("plaintext written successfully\n");
+    }
+    unsigned char *root = Pool_Alloc(32);                                      //the tree is gone before the writer is done
+    memcpy(root, Merkle_Root(&mine), 32);
+    if (Writer_Dump("Hash", root, 32, dumpMode, Pool_Free_Msg, NULL) && dumpMode != DUMP_NONE) {
+        printf("Merkle root queued for Hash%s.\n", DUMP_EXTENSION(dumpMode));
+    }
+
+    unsigned char *ack = malloc(36 + MERKLE_MAX_REPORT * 8);
+    uint64_t *failing = malloc(MERKLE_MAX_REPORT * sizeof(uint64_t));
+    uint32_t count = 0;
+    if (haveTheirs && theirs.leaves == mine.leaves) {
+        count = (uint32_t) Merkle_Diff(&mine, &theirs, failing, MERKLE_MAX_REPORT);
+    } else {
+        printf("Alice sent %zu leaf hashes, expected %zu; reporting the root only\n", theirLeaves, mine.leaves);
+    }
+    memcpy(ack, Merkle_Root(&mine), 32);
+    memcpy(ack + 32, &count, 4);
+    memcpy(ack + 36, failing, count * 8);
+    printf("%zu chunks of %llu bytes, %u corrupted\n", mine.leaves, (unsigned long long)leafSize, count);
+
+    zmq_msg_close(&body);
+    zmq_msg_close(&trailer);
+    zmq_close(responder);
+    zmq_ctx_destroy(context);
+
+    Send_via_ZMQ(ackEndpoint, ack, 36 + count * 8, 0);
+    printf("Acknowledgment sent to Alice via ZeroMQ.\n");
+
+    free(ack);
+    free(failing);
+    Merkle_Free(&mine);
+    if (haveTheirs) {
+        Merkle_Free(&theirs);
+    }
+    return (long long)len;
 }
 
 /*============================
-        SHA-256 Fucntion
+      Session: Serve
 ==============================*/
-unsigned char* Hash_SHA256(unsigned char* input, unsigned long inputlen)
+//Bob's side of --session (see session.h). One ROUTER socket stays bound for the whole
+//session; every DATA message is decrypted in place at its keystream offset, appended to
+//Plaintext.txt, hashed, and answered with an ACK carrying the same seq. Hash.txt gets one
+//hex line per message. Both files go through the background writer (writer.h), so the ack
+//never waits on the disk; a raw payload is handed over as its zmq_msg_t and closed by
+//Session_Release_Payload once written. A seq Bob has already served is a resend whose ack
+//was late or lost: it is acked again but not written twice. Served seqs are kept in a bitmap
+//rather than as a high-water mark, because a resend may also be of a message that never
+//arrived (ZeroMQ drops what was queued on a connection it re-establishes), and that one must
+//still be written; it lands after the messages that overtook it. Runs until Alice sends END.
+//Returns the number of messages served.
+long long Session_Serve(unsigned char *seed, unsigned long seedlen)
 {
-    unsigned char *hash_result = (unsigned char*) malloc(inputlen);
-    //int err;
-    hash_state md;                                                          //LibTomCrypt structure for hash
-    sha256_init(&md);                                                       //Initializing the hash set up
-    sha256_process(&md, (const unsigned char*)input, inputlen);            //Hashing the data given as input with specified length
-    sha256_done(&md, hash_result);                                         //Produces the hash (message digest)
-    
-    return hash_result;
+    toycipher_ctx ctx;                                                         //one keystream for the session, seeked per message
+    Toy_Init(&ctx, seed, seedlen);
+    if (prefetchBytes > 0) {
+        Toy_Prefetch(&ctx, prefetchBytes);                                     //fills while we wait for Alice
+    }
+
+    int plaintxtFile = Writer_Open("Plaintext.txt");
+    int hashFile = Writer_Open_Dump("Hash", dumpMode);                       //one hash per message
+    void *router = Toy_Socket(&ctx, ZMQ_ROUTER);
+    zmq_bind(router, dataEndpoint);
+
+    long long served = 0;
+    unsigned char *seen = NULL;                                                //bit per seq already written
+    size_t seenBytes = 0;
+    for (;;) {
+        zmq_msg_t identity, header, payload;
+        zmq_msg_init(&identity);
+        zmq_msg_init(&header);
+        zmq_msg_init(&payload);
+        uint64_t t = Stats_Clock();
+        if (zmq_msg_recv(&identity, router, 0) < 0 || zmq_msg_recv(&header, router, 0) < 0) {
+            printf("Receive error: %s\n", zmq_strerror(zmq_errno()));
+            served = -1;
+            break;
+        }
+        if (zmq_msg_more(&header)) {
+            zmq_msg_recv(&payload, router, 0);
+        }
+        Stats_Stage(STATS_RECEIVE, t, zmq_msg_size(&payload));
+        Stats_Count(STATS_MESSAGES_RECEIVED, 1);
+        Stats_Count(STATS_BYTES_RECEIVED, zmq_msg_size(&payload));
+        session_header hdr;
+        if (zmq_msg_size(&header) != sizeof(hdr)) {
+            printf("Dropping malformed frame\n");
+            zmq_msg_close(&identity);
+            zmq_msg_close(&header);
+            zmq_msg_close(&payload);
+            continue;
+        }
+        memcpy(&hdr, zmq_msg_data(&header), sizeof(hdr));
+
+        if (hdr.magic == SESSION_MAGIC && hdr.type == SESSION_END) {
+            zmq_msg_send(&identity, router, ZMQ_SNDMORE);                      //echo END so Alice knows we are done
+            zmq_send(router, &hdr, sizeof(hdr), 0);
+            zmq_msg_close(&header);
+            zmq_msg_close(&payload);
+            break;
+        }
+        if (hdr.magic == SESSION_MAGIC && hdr.type == SESSION_DATA && hdr.length == zmq_msg_size(&payload)) {
+            unsigned char *data = (unsigned char*) zmq_msg_data(&payload);
+            unsigned char *plain = data, *inflated = NULL;
+            size_t plainLength = hdr.length;
+            unsigned char hash[32];
+            Toy_Seek(&ctx, hdr.offset);                                        //in order this is where the last message ended
+            if (hdr.flags & SESSION_DEFLATE) {
+                Toy_Crypt_Update(&ctx, data, data, hdr.length);                //hashed once inflated
+                plain = inflated = Session_Inflate(&hdr, data, hash, COMPRESS_MAX_SIZE);
+                plainLength = inflated ? hdr.plain : 0;
+            } else {
+                Toy_Decrypt_Update(&ctx, data, data, hdr.length);
+                Toy_Finish(&ctx, hash);
+            }
+            int fresh = Session_Mark_Seen(&seen, &seenBytes, hdr.seq);
+            if (!fresh) {
+                printf("Message %llu sent again, acking it again\n", (unsigned long long)hdr.seq);
+                Pool_Free(inflated);
+            } else if (inflated) {
+                Writer_Append(plaintxtFile, inflated, plainLength, 0, Pool_Free_Msg, NULL);
+            } else if (plain) {
+                zmq_msg_t *held = Pool_Alloc(sizeof(zmq_msg_t));               //the payload outlives this loop
+                zmq_msg_init(held);
+                zmq_msg_move(held, &payload);
+                Writer_Append(plaintxtFile, (unsigned char*) zmq_msg_data(held), plainLength, 0, Session_Release_Payload, held);
+            }
+            if (fresh) {
+                unsigned char *line = Pool_Alloc(2 * sizeof(hash) + 1);
+                size_t lineLength = sizeof(hash);
+                if (dumpMode == DUMP_HEX) {
+                    Hex_Encode((char*) line, hash, sizeof(hash));
+                    line[2 * sizeof(hash)] = '\n';
+                    lineLength = 2 * sizeof(hash) + 1;
+                } else {
+                    memcpy(line, hash, sizeof(hash));
+                }
+                Writer_Append(hashFile, line, lineLength, 0, Pool_Free_Msg, NULL);
+                served++;
+            }
+
+            session_header ack = { SESSION_MAGIC, SESSION_ACK, hdr.seq, hdr.offset, sizeof(hash) };
+            zmq_msg_send(&identity, router, ZMQ_SNDMORE);
+            zmq_send(router, &ack, sizeof(ack), ZMQ_SNDMORE);
+            zmq_send(router, hash, sizeof(hash), 0);
+        } else {
+            printf("Dropping malformed frame\n");
+            zmq_msg_close(&identity);
+        }
+        zmq_msg_close(&header);
+        zmq_msg_close(&payload);
+    }
+
+    if (ctx.prefetch) {
+        printf("Prefetch: %llu of %llu bytes XORed from the keystream ring\n",
+               ctx.prefetch->hitBytes, ctx.prefetch->hitBytes + ctx.prefetch->missBytes);
+    }
+    Toy_Free(&ctx);
+    Writer_Close(plaintxtFile);
+    Writer_Close(hashFile);
+    free(seen);
+    return served;
+}
+
+//Sets seq's bit in the growing bitmap *seen. Returns 1 if it was not set before (or the
+//bitmap could not grow, so the message is written rather than lost), 0 for a resend.
+int Session_Mark_Seen(unsigned char **seen, size_t *seenBytes, uint64_t seq)
+{
+    size_t at = (size_t)(seq / 8);
+    if (at >= *seenBytes) {
+        size_t grown = *seenBytes ? *seenBytes : 1024;
+        while (grown <= at) {
+            grown *= 2;
+        }
+        unsigned char *bigger = (unsigned char*) realloc(*seen, grown);
+        if (bigger == NULL) {
+            return 1;
+        }
+        memset(bigger + *seenBytes, 0, grown - *seenBytes);
+        *seen = bigger;
+        *seenBytes = grown;
+    }
+    unsigned char bit = (unsigned char)(1u << (seq % 8));
+    if ((*seen)[at] & bit) {
+        return 0;
+    }
+    (*seen)[at] |= bit;
+    return 1;
+}
+
+//Writer release for a raw session payload: `hint` is the zmq_msg_t it was moved into.
+void Session_Release_Payload(void *data, void *hint)
+{
+    (void) data;
+    zmq_msg_close((zmq_msg_t*) hint);
+    Pool_Free(hint);
 }
 
 /*============================
-        Showing in Hex 
+      Session: Inflate
 ==============================*/
-void Show_in_Hex (char name[], unsigned char hex[], int hexlen)
+//Second half of a SESSION_DEFLATE payload (session.h), just decrypted in place: inflates it
+//into a pool buffer of hdr->plain bytes and hashes that, so the ack is still the hash of
+//Alice's original plaintext. hdr->plain comes off the wire: it must be at most `limit`
+//(COMPRESS_MAX_SIZE, or the chunk size for --resume) and within deflate's expansion of
+//hdr->length before anything is allocated for it. Returns the buffer (release with Pool_Free),
+//or NULL with an all-zero hash, which no ack can match, if the payload does not inflate.
+unsigned char *Session_Inflate(const session_header *hdr, const unsigned char *data, unsigned char hash[32], uint64_t limit)
 {
-	printf("%s: ", name);
-	for (int i = 0 ; i < hexlen ; i++)
-   		printf("%02x", hex[i]);
-	printf("\n");
+    if (hdr->plain > limit || hdr->plain > COMPRESS_MAX_SIZE || hdr->plain / COMPRESS_MAX_RATIO > hdr->length) {
+        printf("Message %llu claims to inflate to %llu bytes, dropping it\n", (unsigned long long)hdr->seq, (unsigned long long)hdr->plain);
+        memset(hash, 0, 32);
+        return NULL;
+    }
+    unsigned char *plain = Pool_Alloc(hdr->plain);
+    if (plain == NULL || !Compress_Unpack(data, hdr->length, plain, hdr->plain)) {
+        printf("Message %llu does not inflate to %llu bytes\n", (unsigned long long)hdr->seq, (unsigned long long)hdr->plain);
+        Pool_Free(plain);
+        memset(hash, 0, 32);
+        return NULL;
+    }
+    unsigned char *digest = Hash_SHA256(plain, hdr->plain);
+    memcpy(hash, digest, 32);
+    Pool_Free(digest);
+    return plain;
 }
 
 /*============================
-        PRNG Fucntion 
+        Batch: Serve
 ==============================*/
-unsigned char* PRNG(unsigned char *seed, unsigned long seedlen, unsigned long prnlen)
+//Bob's side of --batch. Every pair's seed is read and keyed once up front; after that a
+//pair is just a lookup by the frame's seq, a decrypt at keystream byte 0 fused with its
+//SHA-256, and the ack. Alice's workers each have their own DEALER connection, so frames
+//from several of them interleave; the ROUTER identity routes every ack to the right one.
+//Plaintexts are checked through the acks rather than written out. Returns the number of
+//pairs decrypted, or -1 if the socket failed.
+long long Batch_Serve(const toy_batch_pair *pairs, size_t count)
 {
-    int err;
-    unsigned char *pseudoRandomNumber = (unsigned char*) malloc(prnlen);
-
-    prng_state prng;                                                           //LibTomCrypt structure for PRNG
-    if ((err = chacha20_prng_start(&prng)) != CRYPT_OK){                       //Sets up the PRNG state without a seed
-        printf("Start error: %s\n", error_to_string(err));
-    }					                
-    if ((err = chacha20_prng_add_entropy(seed, seedlen, &prng)) != CRYPT_OK) {      //Uses a seed to add entropy to the PRNG
-        printf("Add_entropy error: %s\n", error_to_string(err));
-    }	            
-    if ((err = chacha20_prng_ready(&prng)) != CRYPT_OK) {                      //Puts the entropy into action
-        printf("Ready error: %s\n", error_to_string(err));
-    }
-    chacha20_prng_read(pseudoRandomNumber, prnlen, &prng);                     //Writes the result into pseudoRandomNumber[]
-    
-    if ((err = chacha20_prng_done(&prng)) != CRYPT_OK) {                       //Finishes the PRNG state
-        printf("Done error: %s\n", error_to_string(err));
-    }
-
-    return (unsigned char*)pseudoRandomNumber;
+    toycipher_ctx *ciphers = (toycipher_ctx*) malloc(count * sizeof(toycipher_ctx));
+    for (size_t i = 0; i < count; i++) {
+        int seed_length = 0;
+        unsigned char *seed = Read_File((char*) pairs[i].seed, &seed_length);
+        Toy_Init(&ciphers[i], seed, seed_length);
+        Pool_Free(seed);
+    }
+    void *context = zmq_ctx_new();
+    void *router = zmq_socket(context, ZMQ_ROUTER);
+    zmq_bind(router, dataEndpoint);
+
+    long long served = 0, rejected = 0;
+    for (;;) {
+        zmq_msg_t identity, header, payload;
+        zmq_msg_init(&identity);
+        zmq_msg_init(&header);
+        zmq_msg_init(&payload);
+        uint64_t t = Stats_Clock();
+        if (zmq_msg_recv(&identity, router, 0) < 0 || zmq_msg_recv(&header, router, 0) < 0) {
+            printf("Receive error: %s\n", zmq_strerror(zmq_errno()));
+            served = -1;
+            break;
+        }
+        if (zmq_msg_more(&header)) {
+            zmq_msg_recv(&payload, router, 0);
+        }
+        Stats_Stage(STATS_RECEIVE, t, zmq_msg_size(&payload));
+        Stats_Count(STATS_MESSAGES_RECEIVED, 1);
+        Stats_Count(STATS_BYTES_RECEIVED, zmq_msg_size(&payload));
+        session_header hdr;
+        int valid = zmq_msg_size(&header) == sizeof(hdr);
+        if (valid) {
+            memcpy(&hdr, zmq_msg_data(&header), sizeof(hdr));
+            valid = hdr.magic == SESSION_MAGIC;
+        }
+        if (valid && hdr.type == SESSION_END) {
+            zmq_msg_send(&identity, router, ZMQ_SNDMORE);                      //echo END so Alice knows we are done
+            zmq_send(router, &hdr, sizeof(hdr), 0);
+            zmq_msg_close(&header);
+            zmq_msg_close(&payload);
+            break;
+        }
+        if (valid && hdr.type == SESSION_BATCH) {
+            unsigned char hash[32] = {0};                                      //an all-zero ack tells Alice the pair failed
+            if (hdr.seq < count && hdr.length == zmq_msg_size(&payload)) {
+                unsigned char *data = (unsigned char*) zmq_msg_data(&payload);
+                hash_state md;
+                sha256_init(&md);
+                Toy_Decrypt_At(&ciphers[hdr.seq], hdr.offset, data, data, hdr.length, &md);
+                sha256_done(&md, hash);
+                served++;
+            } else {
+                printf("Pair %llu is not in this batch (do the manifests match?)\n", (unsigned long long)hdr.seq);
+                rejected++;
+            }
+            session_header ack = { SESSION_MAGIC, SESSION_ACK, hdr.seq, hdr.offset, sizeof(hash) };
+            zmq_msg_send(&identity, router, ZMQ_SNDMORE);
+            zmq_send(router, &ack, sizeof(ack), ZMQ_SNDMORE);
+            zmq_send(router, hash, sizeof(hash), 0);
+        } else {
+            printf("Dropping malformed frame\n");
+            zmq_msg_close(&identity);
+            rejected++;
+        }
+        zmq_msg_close(&header);
+        zmq_msg_close(&payload);
+    }
+    printf("Batch: %lld of %zu pairs decrypted, %lld frames rejected\n", served, count, rejected);
+
+    zmq_close(router);
+    zmq_ctx_destroy(context);
+    for (size_t i = 0; i < count; i++) {
+        Toy_Free(&ciphers[i]);
+    }
+    free(ciphers);
+    return served;
 }
 
 /*============================
-        Sending via ZeroMQ 
+      Server: Work Queues
 ==============================*/
-void Send_via_ZMQ(unsigned char send[], int sendlen)
+//--server keeps Bob running for any number of Alice sessions at once. The main thread
+//owns the ROUTER socket and only moves frames; decrypt + SHA-256 + ack building happen
+//on a worker pool. Each worker has its own deque: the dispatcher puts a job on the
+//deque with the fewest queued bytes, the owner takes from the front, and an idle worker
+//steals from the back of the fullest deque, so a small message stuck behind a large one
+//gets picked up by whoever is free. `pending` counts queued jobs, so a worker that gets
+//past sem_wait is guaranteed to find one somewhere.
+//Clients may also use plain REQ sockets (loadgen.c): their frames come with an empty
+//delimiter after the identity, and the ack goes back with one so REQ accepts it.
+static volatile sig_atomic_t server_stop = 0;
+
+static void Server_Signal(int sig)
 {
-    void *context = zmq_ctx_new ();					        //creates a socket to talk to Bob
-    void *requester = zmq_socket (context, ZMQ_REQ);		    		//creates requester that sends the messages
-    printf("Connecting to Bob and sending the message...\n");
-    zmq_connect (requester, "tcp://localhost:5556");		    		//make outgoing connection from socket
-    zmq_send (requester, send, sendlen, 0);			    	    	//send msg to Bob
-    zmq_close (requester);						        //closes the requester socket
-    zmq_ctx_destroy (context);					                //destroys the context & terminates all 0MQ processes
+    (void)sig;
+    server_stop = 1;
+}
+
+static void Server_Push_Job(server_deque *dq, server_job *job)
+{
+    pthread_mutex_lock(&dq->lock);
+    job->next = NULL;
+    job->prev = dq->tail;
+    if (dq->tail) dq->tail->next = job; else dq->head = job;
+    dq->tail = job;
+    __atomic_store_n(&dq->queuedBytes, dq->queuedBytes + job->hdr.length, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&dq->lock);
+}
+
+static server_job *Server_Take_Job(server_deque *dq, int fromBack)
+{
+    pthread_mutex_lock(&dq->lock);
+    server_job *job = fromBack ? dq->tail : dq->head;
+    if (job) {
+        if (job->prev) job->prev->next = job->next; else dq->head = job->next;
+        if (job->next) job->next->prev = job->prev; else dq->tail = job->prev;
+        __atomic_store_n(&dq->queuedBytes, dq->queuedBytes - job->hdr.length, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return job;
+}
+
+static void *Server_Worker(void *arg)
+{
+    server_worker *self = (server_worker*) arg;
+    server_pool *pool = self->pool;
+    void *results = zmq_socket(pool->context, ZMQ_PUSH);                        //finished acks go back to the main thread
+    zmq_connect(results, SERVER_RESULTS_ENDPOINT);
+
+    for (;;) {
+        sem_wait(&pool->pending);
+        if (pool->stopping) {
+            break;
+        }
+        server_job *job = Server_Take_Job(&pool->deques[self->id], 0);
+        for (int tries = 0; job == NULL; tries++) {                            //steal from the fullest deque
+            int victim = -1;
+            size_t most = 0;
+            for (int w = 0; w < pool->workers; w++) {                          //a hint only, Take_Job locks
+                size_t queued = __atomic_load_n(&pool->deques[w].queuedBytes, __ATOMIC_RELAXED);
+                if (w != self->id && (victim < 0 || queued >= most)) {
+                    victim = w;
+                    most = queued;
+                }
+            }
+            job = victim >= 0 ? Server_Take_Job(&pool->deques[victim], 1) : NULL;
+            if (job == NULL) {
+                job = Server_Take_Job(&pool->deques[(self->id + 1 + tries) % pool->workers], 1);
+            }
+        }
+
+        unsigned char *data = (unsigned char*) zmq_msg_data(&job->payload);
+        unsigned char hash[32];
+        if (job->hdr.flags & SESSION_DEFLATE) {
+            chacha_kernel_state st = pool->cipher->keystream;                  //this thread only: the workers are the parallelism
+            uint64_t t = Stats_Clock();
+            Chacha_Kernel_Seek(&st, job->hdr.offset);
+            Chacha_Kernel_Xor(&st, data, data, job->hdr.length);
+            Stats_Stage(STATS_XOR, t, job->hdr.length);
+            Pool_Free(Session_Inflate(&job->hdr, data, hash, COMPRESS_MAX_SIZE));   //only the hash is needed
+        } else {
+            hash_state md;
+            sha256_init(&md);
+            Toy_Decrypt_At(pool->cipher, job->hdr.offset, data, data, job->hdr.length, &md);
+            sha256_done(&md, hash);
+        }
+
+        session_header ack = { SESSION_MAGIC, SESSION_ACK, job->hdr.seq, job->hdr.offset, sizeof(hash) };
+        zmq_msg_send(&job->identity, results, ZMQ_SNDMORE);
+        if (job->envelope) {
+            zmq_send(results, "", 0, ZMQ_SNDMORE);
+        }
+        zmq_send(results, &ack, sizeof(ack), ZMQ_SNDMORE);
+        zmq_send(results, hash, sizeof(hash), 0);
+        __atomic_fetch_add(&pool->messages, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&pool->bytes, job->hdr.length, __ATOMIC_RELAXED);
+        zmq_msg_close(&job->payload);
+        Pool_Free(job);
+    }
+    zmq_close(results);
+    return NULL;
 }
 
 /*============================
-        Receiving via ZeroMQ 
+      Server: Main Loop
 ==============================*/
-unsigned char *Receive_via_ZMQ(unsigned char receive[], int *receivelen, int limit) 
+//Runs until SIGINT/SIGTERM. Prints sustained messages/sec and MB/s every `reportSeconds`.
+int Server_Run(unsigned char *seed, unsigned long seedlen, int workers, int reportSeconds)
 {
-	void *context = zmq_ctx_new ();			        	                                 //creates a socket to talk to Alice
-    void *responder = zmq_socket (context, ZMQ_REP);                                   	//creates responder that receives the messages
-   	int rc = zmq_bind (responder, "tcp://*:5555");	                                	//make outgoing connection from socket
-    int received_length = zmq_recv (responder, receive, limit, 0);	                  	//receive message from Alice
-    unsigned char *temp = (unsigned char*) malloc(received_length);
-    for(int i=0; i<received_length; i++){
-        temp[i] = receive[i];
-    }
-    *receivelen = received_length;
-    //printf("Received Message: %s\n", receive);
-    //printf("Size is %d\n", received_length-1);
-    return temp;
+    if (workers <= 0) {
+        workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    toycipher_ctx cipher;
+    Toy_Init(&cipher, seed, seedlen);
+
+    server_pool pool;
+    memset(&pool, 0, sizeof(pool));
+    pool.workers = workers;
+    pool.cipher = &cipher;
+    pool.context = zmq_ctx_new();
+    pool.deques = (server_deque*) calloc(workers, sizeof(server_deque));
+    for (int w = 0; w < workers; w++) {
+        pthread_mutex_init(&pool.deques[w].lock, NULL);
+    }
+    sem_init(&pool.pending, 0, 0);
+
+    void *router = zmq_socket(pool.context, ZMQ_ROUTER);
+    void *results = zmq_socket(pool.context, ZMQ_PULL);
+    void *stats = statsEndpoint ? zmq_socket(pool.context, ZMQ_REP) : NULL;
+    if (stats && zmq_bind(stats, statsEndpoint) != 0) {
+        printf("Cannot bind %s: %s\n", statsEndpoint, zmq_strerror(zmq_errno()));
+        return 1;
+    }
+    zmq_bind(results, SERVER_RESULTS_ENDPOINT);                                //bound before any worker connects
+    if (zmq_bind(router, dataEndpoint) != 0) {
+        printf("Cannot bind %s: %s\n", dataEndpoint, zmq_strerror(zmq_errno()));
+        return 1;
+    }
+
+    server_worker *threads = (server_worker*) calloc(workers, sizeof(server_worker));
+    for (int w = 0; w < workers; w++) {
+        threads[w].id = w;
+        threads[w].pool = &pool;
+        pthread_create(&threads[w].thread, NULL, Server_Worker, &threads[w]);
+    }
+    signal(SIGINT, Server_Signal);
+    signal(SIGTERM, Server_Signal);
+    printf("Bob server listening on %s with %d workers\n", dataEndpoint, workers);
+
+    struct timespec started, lastReport, now;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    lastReport = started;
+    unsigned long long reportedMessages = 0, reportedBytes = 0, sessions = 0;
+
+    zmq_pollitem_t items[] = {
+        { router, 0, ZMQ_POLLIN, 0 },
+        { results, 0, ZMQ_POLLIN, 0 },
+        { stats, 0, ZMQ_POLLIN, 0 },
+    };
+    while (!server_stop) {
+        if (zmq_poll(items, stats ? 3 : 2, 200) < 0) {
+            continue;                                                          //EINTR: loop re-checks server_stop
+        }
+        if (stats && (items[2].revents & ZMQ_POLLIN)) {                        //a stats request: the body is ignored
+            char json[STATS_JSON_SIZE];
+            zmq_msg_t request;
+            zmq_msg_init(&request);
+            zmq_msg_recv(&request, stats, 0);
+            zmq_msg_close(&request);
+            size_t len = Stats_Json(json, sizeof(json), "bob");
+            zmq_send(stats, json, len, 0);
+        }
+        if (items[1].revents & ZMQ_POLLIN) {                                   //forward finished acks to their clients
+            int more;
+            do {
+                zmq_msg_t part;
+                zmq_msg_init(&part);
+                zmq_msg_recv(&part, results, 0);
+                more = zmq_msg_more(&part);
+                zmq_msg_send(&part, router, more ? ZMQ_SNDMORE : 0);
+            } while (more);
+        }
+        while (items[0].revents & ZMQ_POLLIN) {                                //new work from any client
+            server_job *job = (server_job*) Pool_Alloc(sizeof(server_job));    //reused job records: no heap per message
+            memset(job, 0, sizeof(*job));
+            zmq_msg_t header;
+            zmq_msg_init(&job->identity);
+            zmq_msg_init(&header);
+            zmq_msg_init(&job->payload);
+            if (zmq_msg_recv(&job->identity, router, ZMQ_DONTWAIT) < 0) {
+                Pool_Free(job);
+                break;
+            }
+            uint64_t t = Stats_Clock();
+            zmq_msg_recv(&header, router, 0);
+            if (zmq_msg_size(&header) == 0 && zmq_msg_more(&header)) {           //REQ client (loadgen): skip the delimiter
+                job->envelope = 1;
+                zmq_msg_recv(&header, router, 0);
+            }
+            if (zmq_msg_more(&header)) {
+                zmq_msg_recv(&job->payload, router, 0);
+            }
+            Stats_Stage(STATS_RECEIVE, t, zmq_msg_size(&job->payload));
+            Stats_Count(STATS_MESSAGES_RECEIVED, 1);
+            Stats_Count(STATS_BYTES_RECEIVED, zmq_msg_size(&job->payload));
+            int valid = zmq_msg_size(&header) == sizeof(session_header);
+            if (valid) {
+                memcpy(&job->hdr, zmq_msg_data(&header), sizeof(session_header));
+                valid = job->hdr.magic == SESSION_MAGIC;
+            }
+            zmq_msg_close(&header);
+            if (valid && job->hdr.type == SESSION_END) {                       //one client done, keep serving the rest
+                zmq_msg_send(&job->identity, router, ZMQ_SNDMORE);
+                if (job->envelope) {
+                    zmq_send(router, "", 0, ZMQ_SNDMORE);
+                }
+                zmq_send(router, &job->hdr, sizeof(session_header), 0);
+                zmq_msg_close(&job->payload);
+                Pool_Free(job);
+                sessions++;
+                continue;
+            }
+            if (!valid || job->hdr.type != SESSION_DATA || job->hdr.length != zmq_msg_size(&job->payload)) {
+                printf("Dropping malformed frame\n");
+                zmq_msg_close(&job->identity);
+                zmq_msg_close(&job->payload);
+                Pool_Free(job);
+                continue;
+            }
+            int target = 0;                                                    //least loaded deque by queued bytes
+            size_t least = __atomic_load_n(&pool.deques[0].queuedBytes, __ATOMIC_RELAXED);
+            for (int w = 1; w < workers; w++) {
+                size_t queued = __atomic_load_n(&pool.deques[w].queuedBytes, __ATOMIC_RELAXED);
+                if (queued < least) {
+                    target = w;
+                    least = queued;
+                }
+            }
+            Server_Push_Job(&pool.deques[target], job);
+            sem_post(&pool.pending);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double sinceReport = (now.tv_sec - lastReport.tv_sec) + (now.tv_nsec - lastReport.tv_nsec) / 1e9;
+        if (reportSeconds > 0 && sinceReport >= reportSeconds) {
+            unsigned long long messages = __atomic_load_n(&pool.messages, __ATOMIC_RELAXED);
+            unsigned long long bytes = __atomic_load_n(&pool.bytes, __ATOMIC_RELAXED);
+            printf("[bob] %.0f msg/s, %.1f MB/s (%llu messages, %llu sessions closed)\n",
+                   (messages - reportedMessages) / sinceReport, (bytes - reportedBytes) / sinceReport / 1e6,
+                   messages, sessions);
+            fflush(stdout);
+            reportedMessages = messages;
+            reportedBytes = bytes;
+            lastReport = now;
+        }
+    }
+
+    pool.stopping = 1;                                                         //wake every worker so it sees the flag
+    for (int w = 0; w < workers; w++) {
+        sem_post(&pool.pending);
+    }
+    for (int w = 0; w < workers; w++) {
+        pthread_join(threads[w].thread, NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double seconds = (now.tv_sec - started.tv_sec) + (now.tv_nsec - started.tv_nsec) / 1e9;
+    printf("Bob server stopped: %llu messages, %llu bytes in %.1f s (%.0f msg/s)\n",
+           (unsigned long long)pool.messages, (unsigned long long)pool.bytes, seconds,
+           seconds > 0 ? pool.messages / seconds : 0.0);
+
+    for (int w = 0; w < workers; w++) {                                        //jobs nobody got to before the stop
+        server_job *job;
+        while ((job = Server_Take_Job(&pool.deques[w], 0)) != NULL) {
+            zmq_msg_close(&job->identity);
+            zmq_msg_close(&job->payload);
+            Pool_Free(job);
+        }
+        pthread_mutex_destroy(&pool.deques[w].lock);
+    }
+    int linger = 0;
+    zmq_setsockopt(router, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_close(router);
+    zmq_close(results);
+    if (stats) {
+        zmq_setsockopt(stats, ZMQ_LINGER, &linger, sizeof(linger));
+        zmq_close(stats);
+    }
+    zmq_ctx_destroy(pool.context);
+    sem_destroy(&pool.pending);
+    free(pool.deques);
+    free(threads);
+    Toy_Free(&cipher);
+    return 0;
 }
+
 //__________________________________________________________________________________________________________________________
 
@@ -0,0 +1,563 @@
+//////////////////////
+//  ChaCha20 Kernel //
+//////////////////////
+/***********************************************************************
+ *  Toy Steam Cipher Implementation   *
+ ***********************************************************************
+ *Description:  Multi-block ChaCha20 keystream with the XOR fused in.
+ 			1. Chacha_Kernel_Init runs LibTomCrypt's chacha20_prng_start /
+ 			   add_entropy / ready on the seed and copies the resulting
+ 			   ChaCha20 state, so the seed handling is LibTomCrypt's own.
+ 			2. Chacha_Kernel_Xor generates 16 (AVX-512), 8 (AVX2), 4 (SSE2)
+ 			   or 1 (scalar) blocks per iteration and XORs them into the
+ 			   output as they come out of the registers.
+ 			3. Partial blocks are buffered exactly like chacha_crypt does,
+ 			   so any sequence of calls yields the same bytes as
+ 			   chacha20_prng_read.
+ 			4. The block counter makes the keystream seekable: byte N is in
+ 			   block origin + N/64. Chacha_Kernel_Xor_Parallel uses that to
+ 			   cut a buffer into pieces that a small thread pool encrypts
+ 			   independently.
+
+ *Compile:          gcc -c chacha_kernel.c      (SIMD paths use function target
+ *                                               attributes, no -m flags needed; link -lpthread)
+_______________________________________________________________________________*/
+
+//Header Files
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <libtomcrypt/tomcrypt.h>
+#include "chacha_kernel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHACHA_KERNEL_X86 1
+#endif
+
+//Bulk kernels take a whole number of their own width in blocks and advance the counter.
+typedef void (*chacha_bulk_fn)(uint32_t input[16], unsigned char *out, const unsigned char *in, size_t blocks);
+
+static chacha_bulk_fn chacha_bulk = NULL;
+static size_t chacha_width = 1;
+static const char *chacha_name = "scalar";
+static pthread_once_t chacha_selected = PTHREAD_ONCE_INIT;
+
+#define CHACHA_PIECE       (256 * 1024)  // bytes a pool thread takes at a time
+#define CHACHA_MAX_THREADS 64
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define QUARTERROUND(a, b, c, d) \
+    a += b; d ^= a; d = ROTL32(d, 16); \
+    c += d; b ^= c; b = ROTL32(b, 12); \
+    a += b; d ^= a; d = ROTL32(d, 8);  \
+    c += d; b ^= c; b = ROTL32(b, 7);
+
+/*============================
+        Scalar Block
+==============================*/
+//One 64-byte keystream block for the current counter (does not advance it).
+static void Chacha_Block(unsigned char out[64], const uint32_t input[16])
+{
+    uint32_t x[16];
+    memcpy(x, input, sizeof(x));
+    for (int i = 0; i < 10; i++) {                                             //20 rounds = 10 double rounds
+        QUARTERROUND(x[0], x[4], x[8],  x[12])
+        QUARTERROUND(x[1], x[5], x[9],  x[13])
+        QUARTERROUND(x[2], x[6], x[10], x[14])
+        QUARTERROUND(x[3], x[7], x[11], x[15])
+        QUARTERROUND(x[0], x[5], x[10], x[15])
+        QUARTERROUND(x[1], x[6], x[11], x[12])
+        QUARTERROUND(x[2], x[7], x[8],  x[13])
+        QUARTERROUND(x[3], x[4], x[9],  x[14])
+    }
+    for (int i = 0; i < 16; i++) {
+        uint32_t v = x[i] + input[i];
+        out[4 * i + 0] = (unsigned char)(v);
+        out[4 * i + 1] = (unsigned char)(v >> 8);
+        out[4 * i + 2] = (unsigned char)(v >> 16);
+        out[4 * i + 3] = (unsigned char)(v >> 24);
+    }
+}
+
+//64-bit block counter in words 12/13, same as chacha_ivctr64.
+static void Chacha_Counter_Add(uint32_t input[16], uint64_t blocks)
+{
+    uint64_t ctr = ((uint64_t)input[13] << 32 | input[12]) + blocks;
+    input[12] = (uint32_t)ctr;
+    input[13] = (uint32_t)(ctr >> 32);
+}
+
+static void Chacha_Blocks_Scalar(uint32_t input[16], unsigned char *out, const unsigned char *in, size_t blocks)
+{
+    unsigned char ks[64];
+    for (size_t b = 0; b < blocks; b++) {
+        Chacha_Block(ks, input);
+        Chacha_Counter_Add(input, 1);
+        for (int i = 0; i < 64; i++) {
+            out[i] = in[i] ^ ks[i];
+        }
+        out += 64;
+        in += 64;
+    }
+}
+
+#ifdef CHACHA_KERNEL_X86
+/*============================
+        SSE2: 4 blocks
+==============================*/
+//Each register holds one state word for 4 consecutive blocks; after the rounds a
+//4x4 transpose per group of words turns them back into 16-byte pieces of each block.
+#define SSE2_ROTL(v, n) _mm_or_si128(_mm_slli_epi32((v), (n)), _mm_srli_epi32((v), 32 - (n)))
+#define SSE2_QR(a, b, c, d) \
+    a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = SSE2_ROTL(d, 16); \
+    c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = SSE2_ROTL(b, 12); \
+    a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = SSE2_ROTL(d, 8);  \
+    c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = SSE2_ROTL(b, 7);
+
+__attribute__((target("sse2")))
+static void Chacha_Blocks_SSE2(uint32_t input[16], unsigned char *out, const unsigned char *in, size_t blocks)
+{
+    for (size_t b = 0; b < blocks; b += 4) {
+        __m128i x[16], orig[16];
+        uint64_t ctr = (uint64_t)input[13] << 32 | input[12];
+        for (int i = 0; i < 16; i++) {
+            orig[i] = _mm_set1_epi32((int)input[i]);
+        }
+        orig[12] = _mm_setr_epi32((int)(uint32_t)ctr, (int)(uint32_t)(ctr + 1),
+                                  (int)(uint32_t)(ctr + 2), (int)(uint32_t)(ctr + 3));
+        orig[13] = _mm_setr_epi32((int)(uint32_t)(ctr >> 32), (int)(uint32_t)((ctr + 1) >> 32),
+                                  (int)(uint32_t)((ctr + 2) >> 32), (int)(uint32_t)((ctr + 3) >> 32));
+        memcpy(x, orig, sizeof(x));
+        for (int r = 0; r < 10; r++) {
+            SSE2_QR(x[0], x[4], x[8],  x[12])
+            SSE2_QR(x[1], x[5], x[9],  x[13])
+            SSE2_QR(x[2], x[6], x[10], x[14])
+            SSE2_QR(x[3], x[7], x[11], x[15])
+            SSE2_QR(x[0], x[5], x[10], x[15])
+            SSE2_QR(x[1], x[6], x[11], x[12])
+            SSE2_QR(x[2], x[7], x[8],  x[13])
+            SSE2_QR(x[3], x[4], x[9],  x[14])
+        }
+        for (int g = 0; g < 4; g++) {
+            __m128i a = _mm_add_epi32(x[4 * g + 0], orig[4 * g + 0]);
+            __m128i bb = _mm_add_epi32(x[4 * g + 1], orig[4 * g + 1]);
+            __m128i c = _mm_add_epi32(x[4 * g + 2], orig[4 * g + 2]);
+            __m128i d = _mm_add_epi32(x[4 * g + 3], orig[4 * g + 3]);
+            __m128i t0 = _mm_unpacklo_epi32(a, bb), t1 = _mm_unpacklo_epi32(c, d);
+            __m128i t2 = _mm_unpackhi_epi32(a, bb), t3 = _mm_unpackhi_epi32(c, d);
+            __m128i k[4];
+            k[0] = _mm_unpacklo_epi64(t0, t1);                                 //block 0, words 4g..4g+3
+            k[1] = _mm_unpackhi_epi64(t0, t1);
+            k[2] = _mm_unpacklo_epi64(t2, t3);
+            k[3] = _mm_unpackhi_epi64(t2, t3);
+            for (int j = 0; j < 4; j++) {
+                const unsigned char *src = in + 64 * j + 16 * g;
+                unsigned char *dst = out + 64 * j + 16 * g;
+                _mm_storeu_si128((__m128i*)dst, _mm_xor_si128(_mm_loadu_si128((const __m128i*)src), k[j]));
+            }
+        }
+        Chacha_Counter_Add(input, 4);
+        out += 256;
+        in += 256;
+    }
+}
+
+/*============================
+        AVX2: 8 blocks
+==============================*/
+//Same layout as SSE2 with 8 lanes. The 4x4 transposes work inside each 128-bit half,
+//leaving block j in the low half and block j+4 in the high half; permute2x128 splits them.
+#define AVX2_ROT16 _mm256_setr_epi8(2,3,0,1, 6,7,4,5, 10,11,8,9, 14,15,12,13, 2,3,0,1, 6,7,4,5, 10,11,8,9, 14,15,12,13)
+#define AVX2_ROT8  _mm256_setr_epi8(3,0,1,2, 7,4,5,6, 11,8,9,10, 15,12,13,14, 3,0,1,2, 7,4,5,6, 11,8,9,10, 15,12,13,14)
+#define AVX2_ROTL(v, n) _mm256_or_si256(_mm256_slli_epi32((v), (n)), _mm256_srli_epi32((v), 32 - (n)))
+#define AVX2_QR(a, b, c, d) \
+    a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); d = _mm256_shuffle_epi8(d, rot16); \
+    c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = AVX2_ROTL(b, 12);               \
+    a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); d = _mm256_shuffle_epi8(d, rot8);  \
+    c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = AVX2_ROTL(b, 7);
+
+__attribute__((target("avx2")))
+static void Chacha_Blocks_AVX2(uint32_t input[16], unsigned char *out, const unsigned char *in, size_t blocks)
+{
+    const __m256i rot16 = AVX2_ROT16;
+    const __m256i rot8 = AVX2_ROT8;
+    for (size_t b = 0; b < blocks; b += 8) {
+        __m256i x[16], orig[16], k[4][4];
+        uint64_t ctr = (uint64_t)input[13] << 32 | input[12];
+        uint32_t lo[8], hi[8];
+        for (int i = 0; i < 16; i++) {
+            orig[i] = _mm256_set1_epi32((int)input[i]);
+        }
+        for (int j = 0; j < 8; j++) {
+            lo[j] = (uint32_t)(ctr + j);
+            hi[j] = (uint32_t)((ctr + j) >> 32);
+        }
+        orig[12] = _mm256_loadu_si256((const __m256i*)lo);
+        orig[13] = _mm256_loadu_si256((const __m256i*)hi);
+        memcpy(x, orig, sizeof(x));
+        for (int r = 0; r < 10; r++) {
+            AVX2_QR(x[0], x[4], x[8],  x[12])
+            AVX2_QR(x[1], x[5], x[9],  x[13])
+            AVX2_QR(x[2], x[6], x[10], x[14])
+            AVX2_QR(x[3], x[7], x[11], x[15])
+            AVX2_QR(x[0], x[5], x[10], x[15])
+            AVX2_QR(x[1], x[6], x[11], x[12])
+            AVX2_QR(x[2], x[7], x[8],  x[13])
+            AVX2_QR(x[3], x[4], x[9],  x[14])
+        }
+        for (int g = 0; g < 4; g++) {
+            __m256i a = _mm256_add_epi32(x[4 * g + 0], orig[4 * g + 0]);
+            __m256i bb = _mm256_add_epi32(x[4 * g + 1], orig[4 * g + 1]);
+            __m256i c = _mm256_add_epi32(x[4 * g + 2], orig[4 * g + 2]);
+            __m256i d = _mm256_add_epi32(x[4 * g + 3], orig[4 * g + 3]);
+            __m256i t0 = _mm256_unpacklo_epi32(a, bb), t1 = _mm256_unpacklo_epi32(c, d);
+            __m256i t2 = _mm256_unpackhi_epi32(a, bb), t3 = _mm256_unpackhi_epi32(c, d);
+            k[g][0] = _mm256_unpacklo_epi64(t0, t1);                           //blocks 0 | 4, words 4g..4g+3
+            k[g][1] = _mm256_unpackhi_epi64(t0, t1);
+            k[g][2] = _mm256_unpacklo_epi64(t2, t3);
+            k[g][3] = _mm256_unpackhi_epi64(t2, t3);
+        }
+        for (int j = 0; j < 4; j++) {
+            __m256i lo01 = _mm256_permute2x128_si256(k[0][j], k[1][j], 0x20);  //block j, bytes 0..31
+            __m256i lo23 = _mm256_permute2x128_si256(k[2][j], k[3][j], 0x20);  //block j, bytes 32..63
+            __m256i hi01 = _mm256_permute2x128_si256(k[0][j], k[1][j], 0x31);  //block j+4
+            __m256i hi23 = _mm256_permute2x128_si256(k[2][j], k[3][j], 0x31);
+            const unsigned char *s0 = in + 64 * j, *s1 = in + 64 * (j + 4);
+            unsigned char *d0 = out + 64 * j, *d1 = out + 64 * (j + 4);
+            _mm256_storeu_si256((__m256i*)d0, _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)s0), lo01));
+            _mm256_storeu_si256((__m256i*)(d0 + 32), _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(s0 + 32)), lo23));
+            _mm256_storeu_si256((__m256i*)d1, _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)s1), hi01));
+            _mm256_storeu_si256((__m256i*)(d1 + 32), _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(s1 + 32)), hi23));
+        }
+        Chacha_Counter_Add(input, 8);
+        out += 512;
+        in += 512;
+    }
+}
+
+/*============================
+      AVX-512: 16 blocks
+==============================*/
+//After the in-lane transposes, lane L of k[g][j] holds words 4g..4g+3 of block j+4L.
+//Two rounds of shuffle_i32x4 gather the four lanes belonging to one block.
+#define AVX512_QR(a, b, c, d) \
+    a = _mm512_add_epi32(a, b); d = _mm512_xor_si512(d, a); d = _mm512_rol_epi32(d, 16); \
+    c = _mm512_add_epi32(c, d); b = _mm512_xor_si512(b, c); b = _mm512_rol_epi32(b, 12); \
+    a = _mm512_add_epi32(a, b); d = _mm512_xor_si512(d, a); d = _mm512_rol_epi32(d, 8);  \
+    c = _mm512_add_epi32(c, d); b = _mm512_xor_si512(b, c); b = _mm512_rol_epi32(b, 7);
+
+__attribute__((target("avx512f")))
+static void Chacha_Blocks_AVX512(uint32_t input[16], unsigned char *out, const unsigned char *in, size_t blocks)
+{
+    for (size_t b = 0; b < blocks; b += 16) {
+        __m512i x[16], orig[16], k[4][4];
+        uint64_t ctr = (uint64_t)input[13] << 32 | input[12];
+        uint32_t lo[16], hi[16];
+        for (int i = 0; i < 16; i++) {
+            orig[i] = _mm512_set1_epi32((int)input[i]);
+        }
+        for (int j = 0; j < 16; j++) {
+            lo[j] = (uint32_t)(ctr + j);
+            hi[j] = (uint32_t)((ctr + j) >> 32);
+        }
+        orig[12] = _mm512_loadu_si512(lo);
+        orig[13] = _mm512_loadu_si512(hi);
+        memcpy(x, orig, sizeof(x));
+        for (int r = 0; r < 10; r++) {
+            AVX512_QR(x[0], x[4], x[8],  x[12])
+            AVX512_QR(x[1], x[5], x[9],  x[13])
+            AVX512_QR(x[2], x[6], x[10], x[14])
+            AVX512_QR(x[3], x[7], x[11], x[15])
+            AVX512_QR(x[0], x[5], x[10], x[15])
+            AVX512_QR(x[1], x[6], x[11], x[12])
+            AVX512_QR(x[2], x[7], x[8],  x[13])
+            AVX512_QR(x[3], x[4], x[9],  x[14])
+        }
+        for (int g = 0; g < 4; g++) {
+            __m512i a = _mm512_add_epi32(x[4 * g + 0], orig[4 * g + 0]);
+            __m512i bb = _mm512_add_epi32(x[4 * g + 1], orig[4 * g + 1]);
+            __m512i c = _mm512_add_epi32(x[4 * g + 2], orig[4 * g + 2]);
+            __m512i d = _mm512_add_epi32(x[4 * g + 3], orig[4 * g + 3]);
+            __m512i t0 = _mm512_unpacklo_epi32(a, bb), t1 = _mm512_unpacklo_epi32(c, d);
+            __m512i t2 = _mm512_unpackhi_epi32(a, bb), t3 = _mm512_unpackhi_epi32(c, d);
+            k[g][0] = _mm512_unpacklo_epi64(t0, t1);
+            k[g][1] = _mm512_unpackhi_epi64(t0, t1);
+            k[g][2] = _mm512_unpacklo_epi64(t2, t3);
+            k[g][3] = _mm512_unpackhi_epi64(t2, t3);
+        }
+        for (int j = 0; j < 4; j++) {
+            __m512i p_even = _mm512_shuffle_i32x4(k[0][j], k[1][j], 0x88);     //lanes 0,2 of words 0-3 and 4-7
+            __m512i q_even = _mm512_shuffle_i32x4(k[2][j], k[3][j], 0x88);
+            __m512i p_odd = _mm512_shuffle_i32x4(k[0][j], k[1][j], 0xDD);      //lanes 1,3
+            __m512i q_odd = _mm512_shuffle_i32x4(k[2][j], k[3][j], 0xDD);
+            __m512i blk[4];
+            blk[0] = _mm512_shuffle_i32x4(p_even, q_even, 0x88);               //block j
+            blk[2] = _mm512_shuffle_i32x4(p_even, q_even, 0xDD);               //block j+8
+            blk[1] = _mm512_shuffle_i32x4(p_odd, q_odd, 0x88);                 //block j+4
+            blk[3] = _mm512_shuffle_i32x4(p_odd, q_odd, 0xDD);                 //block j+12
+            for (int l = 0; l < 4; l++) {
+                const unsigned char *src = in + 64 * (j + 4 * l);
+                unsigned char *dst = out + 64 * (j + 4 * l);
+                _mm512_storeu_si512(dst, _mm512_xor_si512(_mm512_loadu_si512(src), blk[l]));
+            }
+        }
+        Chacha_Counter_Add(input, 16);
+        out += 1024;
+        in += 1024;
+    }
+}
+#endif
+
+/*============================
+       Runtime Dispatch
+==============================*/
+//Picks the widest kernel the CPU supports once per process. CHACHA_KERNEL in the
+//environment can force a narrower one (handy for checking every path gives the same bytes).
+//Only ever run through pthread_once, so threads that start using the kernel together
+//all see one finished choice.
+static void Chacha_Kernel_Pick(void)
+{
+    const char *force = getenv("CHACHA_KERNEL");
+    chacha_bulk = Chacha_Blocks_Scalar;
+    chacha_width = 1;
+    chacha_name = "scalar";
+#ifdef CHACHA_KERNEL_X86
+    __builtin_cpu_init();
+    if ((force == NULL || strcmp(force, "avx512") == 0) && __builtin_cpu_supports("avx512f")) {
+        chacha_bulk = Chacha_Blocks_AVX512; chacha_width = 16; chacha_name = "avx512";
+    } else if ((force == NULL || strcmp(force, "avx2") == 0) && __builtin_cpu_supports("avx2")) {
+        chacha_bulk = Chacha_Blocks_AVX2; chacha_width = 8; chacha_name = "avx2";
+    } else if ((force == NULL || strcmp(force, "sse2") == 0) && __builtin_cpu_supports("sse2")) {
+        chacha_bulk = Chacha_Blocks_SSE2; chacha_width = 4; chacha_name = "sse2";
+    }
+#endif
+}
+
+static void Chacha_Kernel_Select(void)
+{
+    pthread_once(&chacha_selected, Chacha_Kernel_Pick);
+}
+
+const char *Chacha_Kernel_Name(void)
+{
+    Chacha_Kernel_Select();
+    return chacha_name;
+}
+
+/*============================
+        Kernel Setup
+==============================*/
+//Seeds exactly like PRNG(): LibTomCrypt decides how the seed becomes key and IV,
+//we only take over the ready ChaCha20 state.
+void Chacha_Kernel_Init(chacha_kernel_state *st, const unsigned char *seed, unsigned long seedlen)
+{
+    int err;
+    prng_state prng;
+    if ((err = chacha20_prng_start(&prng)) != CRYPT_OK) {
+        printf("Start error: %s\n", error_to_string(err));
+    }
+    if ((err = chacha20_prng_add_entropy(seed, seedlen, &prng)) != CRYPT_OK) {
+        printf("Add_entropy error: %s\n", error_to_string(err));
+    }
+    if ((err = chacha20_prng_ready(&prng)) != CRYPT_OK) {
+        printf("Ready error: %s\n", error_to_string(err));
+    }
+    for (int i = 0; i < 16; i++) st->input[i] = (uint32_t)prng.u.chacha.s.input[i];
+    if ((err = chacha20_prng_done(&prng)) != CRYPT_OK) {
+        printf("Done error: %s\n", error_to_string(err));
+    }
+    st->ksleft = 0;
+    st->origin = (uint64_t)st->input[13] << 32 | st->input[12];
+    Chacha_Kernel_Select();
+}
+
+/*============================
+        Keystream Seek
+==============================*/
+//Positions the keystream at byte `offset` from its start, wherever it currently is.
+void Chacha_Kernel_Seek(chacha_kernel_state *st, uint64_t offset)
+{
+    uint64_t ctr = st->origin + offset / 64;
+    st->input[12] = (uint32_t)ctr;
+    st->input[13] = (uint32_t)(ctr >> 32);
+    st->ksleft = 0;
+    if (offset % 64) {
+        Chacha_Block(st->kstream, st->input);
+        Chacha_Counter_Add(st->input, 1);
+        st->ksleft = 64 - (unsigned int)(offset % 64);
+    }
+}
+
+/*============================
+     Fused Keystream XOR
+==============================*/
+void Chacha_Kernel_Xor(chacha_kernel_state *st, unsigned char *out, const unsigned char *in, size_t len)
+{
+    //1. finish the block a previous call started
+    while (st->ksleft > 0 && len > 0) {
+        *out++ = *in++ ^ st->kstream[64 - st->ksleft--];
+        len--;
+    }
+    //2. whole blocks, widest kernel first
+    size_t blocks = len / 64;
+    size_t wide = blocks - blocks % chacha_width;
+    if (wide > 0) {
+        chacha_bulk(st->input, out, in, wide);
+        out += 64 * wide;
+        in += 64 * wide;
+        len -= 64 * wide;
+        blocks -= wide;
+    }
+    if (blocks > 0) {
+        Chacha_Blocks_Scalar(st->input, out, in, blocks);
+        out += 64 * blocks;
+        in += 64 * blocks;
+        len -= 64 * blocks;
+    }
+    //3. tail: keep the rest of the block for the next call
+    if (len > 0) {
+        Chacha_Block(st->kstream, st->input);
+        Chacha_Counter_Add(st->input, 1);
+        for (size_t i = 0; i < len; i++) {
+            out[i] = in[i] ^ st->kstream[i];
+        }
+        st->ksleft = 64 - (unsigned int)len;
+    }
+}
+
+//Raw keystream, only needed for the Key.txt diagnostics.
+void Chacha_Kernel_Keystream(chacha_kernel_state *st, unsigned char *out, size_t len)
+{
+    memset(out, 0, len);
+    Chacha_Kernel_Xor(st, out, out, len);
+}
+
+/*============================
+      Parallel Keystream
+==============================*/
+//A fixed pool of worker threads, started on first use. For each call the buffer is cut
+//into CHACHA_PIECE sized pieces; the caller and the workers take pieces off a shared
+//counter, seek their own copy of the state to the piece and XOR it. Output is identical
+//to one sequential Chacha_Kernel_Xor since every byte uses the keystream at its offset.
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;                 // workers wait here for a new job
+    pthread_cond_t done;                 // caller waits here for the workers
+    pthread_mutex_t call;                // one parallel call at a time
+    pthread_t threads[CHACHA_MAX_THREADS];
+    int nthreads;                        // workers, the caller is the extra thread
+    int wanted;                          // total threads requested, 0 = one per CPU
+    pthread_once_t started;
+    int busy;
+    unsigned long generation;
+    chacha_kernel_state base;
+    uint64_t offset;
+    unsigned char *out;
+    const unsigned char *in;
+    size_t len;
+    size_t pieces;
+    size_t next;
+} chacha_pool = { .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER,
+                  .done = PTHREAD_COND_INITIALIZER, .call = PTHREAD_MUTEX_INITIALIZER,
+                  .started = PTHREAD_ONCE_INIT };
+
+//Threads (including the caller) used by Chacha_Kernel_Xor_Parallel; call before first use.
+void Chacha_Kernel_Threads(int threads)
+{
+    chacha_pool.wanted = threads;
+}
+
+static void Chacha_Pool_Run_Pieces(void)
+{
+    size_t piece;
+    while ((piece = __atomic_fetch_add(&chacha_pool.next, 1, __ATOMIC_RELAXED)) < chacha_pool.pieces) {
+        size_t start = piece * CHACHA_PIECE;
+        size_t n = chacha_pool.len - start < CHACHA_PIECE ? chacha_pool.len - start : CHACHA_PIECE;
+        chacha_kernel_state st = chacha_pool.base;
+        Chacha_Kernel_Seek(&st, chacha_pool.offset + start);
+        Chacha_Kernel_Xor(&st, chacha_pool.out + start, chacha_pool.in + start, n);
+    }
+}
+
+static void *Chacha_Pool_Worker(void *arg)
+{
+    unsigned long seen = 0;
+    (void)arg;
+    for (;;) {
+        pthread_mutex_lock(&chacha_pool.lock);
+        while (chacha_pool.generation == seen) {
+            pthread_cond_wait(&chacha_pool.wake, &chacha_pool.lock);
+        }
+        seen = chacha_pool.generation;
+        pthread_mutex_unlock(&chacha_pool.lock);
+
+        Chacha_Pool_Run_Pieces();
+
+        pthread_mutex_lock(&chacha_pool.lock);
+        if (--chacha_pool.busy == 0) {
+            pthread_cond_signal(&chacha_pool.done);
+        }
+        pthread_mutex_unlock(&chacha_pool.lock);
+    }
+    return NULL;
+}
+
+static void Chacha_Pool_Start(void)
+{
+    int threads = chacha_pool.wanted;
+    if (threads <= 0) {
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (threads > CHACHA_MAX_THREADS + 1) {
+        threads = CHACHA_MAX_THREADS + 1;
+    }
+    chacha_pool.nthreads = 0;
+    for (int i = 0; i < threads - 1; i++) {
+        if (pthread_create(&chacha_pool.threads[i], NULL, Chacha_Pool_Worker, NULL) != 0) {
+            printf("Could not start keystream thread %d, continuing with %d\n", i + 1, chacha_pool.nthreads + 1);
+            break;
+        }
+        pthread_detach(chacha_pool.threads[i]);
+        chacha_pool.nthreads++;
+    }
+}
+
+//out = in XOR keystream[offset .. offset+len) of the stream described by st (st is not changed).
+//Small buffers never touch the pool, and a call that finds the pool busy with another thread's
+//buffer does its own XOR inline instead of queueing behind it.
+void Chacha_Kernel_Xor_Parallel(const chacha_kernel_state *st, uint64_t offset, unsigned char *out, const unsigned char *in, size_t len)
+{
+    pthread_once(&chacha_pool.started, Chacha_Pool_Start);
+    if (chacha_pool.nthreads == 0 || len < 2 * CHACHA_PIECE                   //not worth waking anyone
+        || pthread_mutex_trylock(&chacha_pool.call) != 0) {                    //pool taken: this thread alone is still full speed
+        chacha_kernel_state copy = *st;
+        Chacha_Kernel_Seek(&copy, offset);
+        Chacha_Kernel_Xor(&copy, out, in, len);
+        return;
+    }
+
+    pthread_mutex_lock(&chacha_pool.lock);
+    chacha_pool.base = *st;
+    chacha_pool.offset = offset;
+    chacha_pool.out = out;
+    chacha_pool.in = in;
+    chacha_pool.len = len;
+    chacha_pool.pieces = (len + CHACHA_PIECE - 1) / CHACHA_PIECE;
+    chacha_pool.next = 0;
+    chacha_pool.busy = chacha_pool.nthreads;
+    chacha_pool.generation++;
+    pthread_cond_broadcast(&chacha_pool.wake);
+    pthread_mutex_unlock(&chacha_pool.lock);
+
+    Chacha_Pool_Run_Pieces();                                                  //the caller works too
+
+    pthread_mutex_lock(&chacha_pool.lock);
+    while (chacha_pool.busy > 0) {
+        pthread_cond_wait(&chacha_pool.done, &chacha_pool.lock);
+    }
+    pthread_mutex_unlock(&chacha_pool.lock);
+    pthread_mutex_unlock(&chacha_pool.call);
+}
@@ -0,0 +1,45 @@
+//////////////////////
+//  ChaCha20 Kernel //
+//////////////////////
+/***********************************************************************
+ *  Toy Steam Cipher Implementation   *
+ ***********************************************************************
+ *Description:  In-tree ChaCha20 keystream generator shared by Alice and Bob.
+ 			It produces exactly the same bytes as LibTomCrypt's chacha20_prng_*
+ 			functions for a given seed, but computes 4/8/16 blocks at a time
+ 			with SSE2/AVX2/AVX-512 (picked at runtime, scalar fallback) and XORs
+ 			the keystream straight into the output buffer, so no key buffer
+ 			ever has to be allocated.
+
+ *Use:              chacha_kernel_state st;
+ *                  Chacha_Kernel_Init(&st, seed, seedlen);
+ *                  Chacha_Kernel_Xor(&st, out, in, len);     // out = in XOR keystream, in may equal out
+ *
+ *                  Chacha_Kernel_Seek(&st, offset);          // keystream is counter based, jump anywhere
+ *                  Chacha_Kernel_Xor_Parallel(&st, offset, out, in, len);
+ *                                                            // same bytes, split over a thread pool
+ *
+ *Override:         CHACHA_KERNEL=scalar|sse2|avx2|avx512 forces an implementation
+_______________________________________________________________________________*/
+#ifndef CHACHA_KERNEL_H
+#define CHACHA_KERNEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    uint32_t input[16];          // ChaCha20 state: constants, key, 64-bit block counter, IV
+    unsigned char kstream[64];   // unused tail of the last block
+    unsigned int ksleft;         // bytes of kstream[] still unused
+    uint64_t origin;             // block counter at byte 0 of the keystream
+} chacha_kernel_state;
+
+void Chacha_Kernel_Init(chacha_kernel_state *st, const unsigned char *seed, unsigned long seedlen);
+void Chacha_Kernel_Xor(chacha_kernel_state *st, unsigned char *out, const unsigned char *in, size_t len);
+void Chacha_Kernel_Keystream(chacha_kernel_state *st, unsigned char *out, size_t len);
+void Chacha_Kernel_Seek(chacha_kernel_state *st, uint64_t offset);
+void Chacha_Kernel_Xor_Parallel(const chacha_kernel_state *st, uint64_t offset, unsigned char *out, const unsigned char *in, size_t len);
+void Chacha_Kernel_Threads(int threads);
+const char *Chacha_Kernel_Name(void);
+
+#endif
@@ -0,0 +1,116 @@
+//////////////////////
+//   Compression    //
+//////////////////////
+/***********************************************************************
+ *  Toy Steam Cipher Implementation   *
+ ***********************************************************************
+ *Description:  Deflate/inflate of session payloads (compress.h).
+ 			1. The deflate writes into a buffer 1/8 smaller than the input;
+ 			   running out of room there means "send it raw".
+ 			2. zlib counts in 32-bit units, so both directions feed it at
+ 			   most COMPRESS_STEP bytes at a time; payloads may be larger.
+ 			3. Each thread keeps one deflate and one inflate stream and resets
+ 			   it per payload: setting a deflate stream up allocates and
+ 			   clears a few hundred KiB, far more than a small message costs.
+
+ *Compile:          gcc -c compress.c     (part of libtoycipher, see toycipher.h; link with -lz)
+_______________________________________________________________________________*/
+
+//Header Files
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <zlib.h>
+#include "compress.h"
+#include "pool.h"
+#include "stats.h"
+
+#define COMPRESS_STEP ((size_t)1 << 30)        // most bytes handed to zlib per call
+
+static __thread z_stream deflater, inflater;
+static __thread int deflaterReady, inflaterReady;
+
+//Deflates input[len] into out[room]. Returns the deflated length, or 0 if it did not fit.
+static size_t Compress_Deflate(const unsigned char *input, size_t len, unsigned char *out, size_t room)
+{
+    z_stream *z = &deflater;
+    if (deflaterReady) {
+        deflateReset(z);
+    } else if (deflateInit(z, COMPRESS_LEVEL) == Z_OK) {
+        deflaterReady = 1;
+    } else {
+        return 0;
+    }
+    z->next_in = (unsigned char*) input;
+    z->next_out = out;
+    int status = Z_OK;
+    while (status == Z_OK) {
+        size_t inLeft = len - (size_t)(z->next_in - input);
+        size_t outLeft = room - (size_t)(z->next_out - out);
+        if (outLeft == 0) {
+            break;                                                             //past the 1/8 mark: not worth it
+        }
+        z->avail_in = (uInt)(inLeft < COMPRESS_STEP ? inLeft : COMPRESS_STEP);
+        z->avail_out = (uInt)(outLeft < COMPRESS_STEP ? outLeft : COMPRESS_STEP);
+        status = deflate(z, inLeft <= COMPRESS_STEP ? Z_FINISH : Z_NO_FLUSH);
+    }
+    return status == Z_STREAM_END ? (size_t)(z->next_out - out) : 0;
+}
+
+/*============================
+        Pack / Unpack
+==============================*/
+//Deflates a payload into a pool buffer at *packed (release with Pool_Free) and returns its
+//length. Returns 0 with *packed = NULL when the payload should go raw: too small, or it did
+//not shrink by 1/COMPRESS_MIN_SAVING, or it is over COMPRESS_MAX_SIZE (Bob would not inflate it).
+size_t Compress_Pack(const unsigned char *input, size_t len, unsigned char **packed)
+{
+    *packed = NULL;
+    if (len < COMPRESS_MIN_SIZE || len > COMPRESS_MAX_SIZE) {
+        return 0;
+    }
+    uint64_t t = Stats_Clock();
+    size_t room = len - len / COMPRESS_MIN_SAVING;
+    unsigned char *out = Pool_Alloc(room);
+    size_t produced = 0;
+    if (out != NULL && (len <= 4 * COMPRESS_PROBE
+                        || Compress_Deflate(input, COMPRESS_PROBE, out, COMPRESS_PROBE - COMPRESS_PROBE / COMPRESS_MIN_SAVING) > 0)) {
+        produced = Compress_Deflate(input, len, out, room);
+    }
+    Stats_Stage(STATS_COMPRESS, t, len);
+    if (produced == 0) {
+        Stats_Count(STATS_COMPRESS_BYPASSED, 1);
+        Pool_Free(out);
+        return 0;
+    }
+    *packed = out;
+    return produced;
+}
+
+//Inflates packed[len] into out[outlen]. Returns 1 only if the stream is complete and comes
+//to exactly outlen bytes; anything else means the payload is corrupt.
+int Compress_Unpack(const unsigned char *packed, size_t len, unsigned char *out, size_t outlen)
+{
+    z_stream *z = &inflater;
+    if (inflaterReady) {
+        inflateReset(z);
+    } else if (inflateInit(z) == Z_OK) {
+        inflaterReady = 1;
+    } else {
+        return 0;
+    }
+    uint64_t t = Stats_Clock();
+    z->next_in = (unsigned char*) packed;
+    z->next_out = out;
+    int status = Z_OK;
+    while (status == Z_OK) {
+        size_t inLeft = len - (size_t)(z->next_in - packed);
+        size_t outLeft = outlen - (size_t)(z->next_out - out);
+        z->avail_in = (uInt)(inLeft < COMPRESS_STEP ? inLeft : COMPRESS_STEP);
+        z->avail_out = (uInt)(outLeft < COMPRESS_STEP ? outLeft : COMPRESS_STEP);
+        status = inflate(z, Z_NO_FLUSH);
+    }
+    int ok = status == Z_STREAM_END && (size_t)(z->next_out - out) == outlen && (size_t)(z->next_in - packed) == len;
+    Stats_Stage(STATS_DECOMPRESS, t, outlen);
+    return ok;
+}
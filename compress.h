@@ -0,0 +1,44 @@
+//////////////////////
+//   Compression    //
+//////////////////////
+/***********************************************************************
+ *  Toy Steam Cipher Implementation   *
+ ***********************************************************************
+ *Description:  Optional compress-then-encrypt stage for the framed modes
+ 			(--session, --server, --resume; see session.h).
+ 			    - zlib deflate at level 1: the fastest setting, and most of
+ 			      the gain on logs and JSON
+ 			    - Alice deflates a payload before encrypting it, so both the
+ 			      bytes on the wire and the keystream to generate shrink
+ 			    - a payload that does not shrink by at least 1/8 is sent raw;
+ 			      the deflate stops as soon as its output passes that mark,
+ 			      and a large payload whose first 64 KiB do not shrink is not
+ 			      tried at all
+ 			    - Bob decrypts, then inflates; the ack is still the SHA-256
+ 			      of the original plaintext
+ 			    - the inflated size comes off the wire, so Bob only trusts it
+ 			      up to COMPRESS_MAX_SIZE and COMPRESS_MAX_RATIO times the
+ 			      packed size
+ 			Deflate/inflate time and bytes are recorded in stats.c.
+
+ *Use:              unsigned char *packed;
+ *                  size_t packedLen = Compress_Pack(message, len, &packed);   // 0 = send it raw
+ *                  ...encrypt packed[packedLen], Pool_Free(packed)...
+ *                  Compress_Unpack(packed, packedLen, plain, len);            // 1 = exactly len bytes came out
+_______________________________________________________________________________*/
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+
+#define COMPRESS_LEVEL      1                   // zlib level: fastest
+#define COMPRESS_MIN_SIZE   256                 // smaller payloads are always sent raw
+#define COMPRESS_MIN_SAVING 8                   // must save at least 1/8 of the payload
+#define COMPRESS_PROBE      (64 * 1024)         // payloads over 4x this are probed on their first 64 KiB
+#define COMPRESS_MAX_SIZE   (1024ull * 1024 * 1024)   // larger payloads are always sent raw, and never inflated
+#define COMPRESS_MAX_RATIO  1032                // deflate's worst case: one packed byte never inflates to more
+
+size_t Compress_Pack(const unsigned char *input, size_t len, unsigned char **packed);
+int Compress_Unpack(const unsigned char *packed, size_t len, unsigned char *out, size_t outlen);
+
+#endif
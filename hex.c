@@ -0,0 +1,118 @@
+//////////////////////
+//   Hex Encoding   //
+//////////////////////
+/***********************************************************************
+ *  Toy Steam Cipher Implementation   *
+ ***********************************************************************
+ *Description:  Table/SSE2 hex encoder and the dump helpers from hex.h.
+
+ *Compile:          gcc -c hex.c
+_______________________________________________________________________________*/
+
+//Header Files
+#include <stdio.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "hex.h"
+#include "stats.h"
+
+//"%02x" of every byte value, two characters each.
+static const char hexPairs[513] =
+    "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+    "202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+    "404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f"
+    "606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f"
+    "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f"
+    "a0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+    "c0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+    "e0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+/*============================
+         Hex Encode
+==============================*/
+//Writes 2*len characters to out (no terminating NUL).
+void Hex_Encode(char *out, const unsigned char *in, size_t len)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    //split every byte into its two nibbles, interleave them high-first, then map
+    //0-9 to '0'-'9' and 10-15 to 'a'-'f' with a compare instead of a lookup
+    const __m128i low4 = _mm_set1_epi8(0x0f);
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i digit = _mm_set1_epi8('0');
+    const __m128i letter = _mm_set1_epi8('a' - '0' - 10);
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), low4);
+        __m128i lo = _mm_and_si128(v, low4);
+        __m128i a = _mm_unpacklo_epi8(hi, lo);
+        __m128i b = _mm_unpackhi_epi8(hi, lo);
+        a = _mm_add_epi8(_mm_add_epi8(a, digit), _mm_and_si128(_mm_cmpgt_epi8(a, nine), letter));
+        b = _mm_add_epi8(_mm_add_epi8(b, digit), _mm_and_si128(_mm_cmpgt_epi8(b, nine), letter));
+        _mm_storeu_si128((__m128i*)(out + 2 * i), a);
+        _mm_storeu_si128((__m128i*)(out + 2 * i + 16), b);
+    }
+#endif
+    for (; i < len; i++) {
+        memcpy(out + 2 * i, hexPairs + 2 * in[i], 2);
+    }
+}
+
+//Hex-encodes data into `file` HEX_BLOCK bytes at a time. Returns 1 on success.
+int Hex_Write(FILE *file, const unsigned char *data, size_t len)
+{
+    char text[2 * HEX_BLOCK];
+    for (size_t off = 0; off < len; off += HEX_BLOCK) {
+        size_t n = len - off < HEX_BLOCK ? len - off : HEX_BLOCK;
+        Hex_Encode(text, data + off, n);
+        if (fwrite(text, 1, 2 * n, file) != 2 * n) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*============================
+         Dump Files
+==============================*/
+//Opens name.txt or name.bin for the given mode; NULL for DUMP_NONE or on error.
+FILE *Dump_Open(const char *name, int mode)
+{
+    char fileName[256];
+    if (mode == DUMP_NONE) {
+        return NULL;
+    }
+    snprintf(fileName, sizeof(fileName), "%s%s", name, DUMP_EXTENSION(mode));
+    FILE *file = fopen(fileName, mode == DUMP_BINARY ? "wb" : "w");
+    if (file == NULL) {
+        printf("Error opening %s for writing\n", fileName);
+    }
+    return file;
+}
+
+int Dump_Write(FILE *file, const unsigned char *data, size_t len, int mode)
+{
+    if (file == NULL) {
+        return mode == DUMP_NONE;
+    }
+    uint64_t t = Stats_Clock();
+    int ok = mode == DUMP_BINARY ? fwrite(data, 1, len, file) == len : Hex_Write(file, data, len);
+    Stats_Stage(STATS_HEX_DUMP, t, len);
+    return ok;
+}
+
+//Whole dump in one call. Returns 1 when written (or skipped with DUMP_NONE), 0 on error.
+int Dump_File(const char *name, const unsigned char *data, size_t len, int mode)
+{
+    if (mode == DUMP_NONE) {
+        return 1;
+    }
+    FILE *file = Dump_Open(name, mode);
+    if (file == NULL) {
+        return 0;
+    }
+    int ok = Dump_Write(file, data, len, mode);
+    return fclose(file) == 0 && ok;
+}
@@ -0,0 +1,36 @@
+//////////////////////
+//   Hex Encoding   //
+//////////////////////
+/***********************************************************************
+ *  Toy Steam Cipher Implementation   *
+ ***********************************************************************
+ *Description:  Fast hex output for the Key/Ciphertext/Hash dumps.
+ 			Bytes are expanded 16 at a time with SSE2 (a 512-byte pair
+ 			table handles the tail) into a block buffer that is written
+ 			with one fwrite, instead of one fprintf("%02x") per byte.
+ 			The dumps can also be written as raw binary (name.bin) or
+ 			skipped entirely (--binary / --no-dumps).
+_______________________________________________________________________________*/
+#ifndef HEX_H
+#define HEX_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define HEX_BLOCK (32 * 1024)          // input bytes encoded per fwrite
+
+enum dump_mode {
+    DUMP_HEX = 0,                      // name.txt, lowercase hex (default, what the test vectors use)
+    DUMP_BINARY,                       // name.bin, raw bytes
+    DUMP_NONE                          // no file at all
+};
+
+#define DUMP_EXTENSION(mode) ((mode) == DUMP_BINARY ? ".bin" : ".txt")
+
+void Hex_Encode(char *out, const unsigned char *in, size_t len);
+int Hex_Write(FILE *file, const unsigned char *data, size_t len);
+FILE *Dump_Open(const char *name, int mode);
+int Dump_Write(FILE *file, const unsigned char *data, size_t len, int mode);
+int Dump_File(const char *name, const unsigned char *data, size_t len, int mode);
+
+#endif
@@ -0,0 +1,202 @@
+//////////////////////
+//  Keystream Ring  //
+//////////////////////
+/***********************************************************************
+ *  Toy Steam Cipher Implementation   *
+ ***********************************************************************
+ *Description:  Single-producer/single-consumer keystream ring (keystream_ring.h).
+ 			1. The producer generates KEYSTREAM_RING_BLOCK bytes at a time
+ 			   straight into the ring and publishes them by moving head.
+ 			2. When the ring is full it sleeps on `space` until the consumer
+ 			   moves tail. The consumer only takes the lock when the producer
+ 			   has said it is waiting, so it never blocks on the producer.
+ 			3. If tail has jumped past head, the producer seeks its
+ 			   keystream to tail and carries on from there.
+
+ *Compile:          gcc -c keystream_ring.c     (link -lpthread)
+_______________________________________________________________________________*/
+
+//Header Files
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "keystream_ring.h"
+
+#define KEYSTREAM_RING_NAP_NS  20000   // producer sleep while the ring is full, if it cannot block
+#define KEYSTREAM_RING_WAIT_MS 50      // longest single wait on `space` (a missed wakeup costs no more)
+
+/*============================
+        Full Ring Wait
+==============================*/
+//Called by the producer with the ring full at h - t. Sleeps until the consumer moves tail
+//past t or the ring is stopped. producerWaiting and tail are both seq_cst, so either the
+//consumer sees the flag after storing tail, or we see the new tail before sleeping.
+static void Keystream_Ring_Wait_Space(keystream_ring *r, uint64_t t)
+{
+    if (!r->canBlock) {
+        struct timespec nap = { 0, KEYSTREAM_RING_NAP_NS };
+        nanosleep(&nap, NULL);
+        return;
+    }
+    pthread_mutex_lock(&r->lock);
+    __atomic_store_n(&r->producerWaiting, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r->tail, __ATOMIC_SEQ_CST) == t && !__atomic_load_n(&r->stopping, __ATOMIC_SEQ_CST)) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += KEYSTREAM_RING_WAIT_MS * 1000000L;
+        if (until.tv_nsec >= 1000000000L) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&r->space, &r->lock, &until);
+    }
+    __atomic_store_n(&r->producerWaiting, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&r->lock);
+}
+
+//Consumer/Stop side: wakes the producer if it is waiting for space.
+static void Keystream_Ring_Wake(keystream_ring *r)
+{
+    if (r->canBlock && __atomic_load_n(&r->producerWaiting, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&r->lock);
+        pthread_cond_signal(&r->space);
+        pthread_mutex_unlock(&r->lock);
+    }
+}
+
+/*============================
+          Producer
+==============================*/
+static void *Keystream_Ring_Producer(void *arg)
+{
+    keystream_ring *r = (keystream_ring*) arg;
+    uint64_t h = r->head;
+    while (!__atomic_load_n(&r->stopping, __ATOMIC_RELAXED)) {
+        uint64_t t = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);             //slots below t are free again
+        if (h < t) {                                                           //consumer skipped ahead of us
+            h = t;
+            Chacha_Kernel_Seek(&r->keystream, h);
+            __atomic_store_n(&r->head, h, __ATOMIC_RELEASE);
+        }
+        size_t room = r->capacity - (size_t)(h - t);
+        if (room == 0) {
+            Keystream_Ring_Wait_Space(r, t);
+            continue;
+        }
+        size_t at = (size_t)(h % r->capacity);
+        size_t n = KEYSTREAM_RING_BLOCK;
+        if (n > room) n = room;
+        if (n > r->capacity - at) n = r->capacity - at;                        //never wrap inside one block
+        Chacha_Kernel_Keystream(&r->keystream, r->buffer + at, n);
+        h += n;
+        __atomic_store_n(&r->head, h, __ATOMIC_RELEASE);                       //bytes are written before head says so
+    }
+    return NULL;
+}
+
+/*============================
+          Start / Stop
+==============================*/
+//Starts producing the keystream of st from byte `position` on, keeping up to `capacity` bytes
+//(rounded up to a whole block, at most KEYSTREAM_RING_MAX) ready. st itself is not changed.
+//Returns 1 on success; on failure nothing is left running.
+int Keystream_Ring_Start(keystream_ring *r, const chacha_kernel_state *st, uint64_t position, size_t capacity)
+{
+    memset(r, 0, sizeof(*r));
+    if (capacity > KEYSTREAM_RING_MAX) {
+        capacity = KEYSTREAM_RING_MAX;
+    }
+    capacity = (capacity + KEYSTREAM_RING_BLOCK - 1) / KEYSTREAM_RING_BLOCK * KEYSTREAM_RING_BLOCK;
+    if (capacity == 0) {
+        capacity = KEYSTREAM_RING_BLOCK;
+    }
+    r->buffer = (unsigned char*) malloc(capacity);
+    if (r->buffer == NULL) {
+        printf("Out of memory for a %zu byte keystream ring\n", capacity);
+        return 0;
+    }
+    r->capacity = capacity;
+    r->keystream = *st;
+    Chacha_Kernel_Seek(&r->keystream, position);
+    r->head = r->tail = position;
+    if (pthread_mutex_init(&r->lock, NULL) == 0) {
+        if (pthread_cond_init(&r->space, NULL) == 0) {
+            r->canBlock = 1;
+        } else {
+            pthread_mutex_destroy(&r->lock);                                   //fall back to napping
+        }
+    }
+    if (pthread_create(&r->thread, NULL, Keystream_Ring_Producer, r) != 0) {
+        printf("Could not start the keystream producer\n");
+        if (r->canBlock) {
+            pthread_cond_destroy(&r->space);
+            pthread_mutex_destroy(&r->lock);
+        }
+        free(r->buffer);
+        r->buffer = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+void Keystream_Ring_Stop(keystream_ring *r)
+{
+    if (r->buffer == NULL) {
+        return;
+    }
+    __atomic_store_n(&r->stopping, 1, __ATOMIC_SEQ_CST);
+    Keystream_Ring_Wake(r);
+    pthread_join(r->thread, NULL);
+    if (r->canBlock) {
+        pthread_cond_destroy(&r->space);
+        pthread_mutex_destroy(&r->lock);
+    }
+    memset(r->buffer, 0, r->capacity);                                         //don't leave keystream behind
+    free(r->buffer);
+    r->buffer = NULL;
+}
+
+/*============================
+        Consumer XOR
+==============================*/
+static void Keystream_Ring_Xor_Bytes(unsigned char *out, const unsigned char *in, const unsigned char *key, size_t len)
+{
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t a, b;
+        memcpy(&a, in + i, 8);
+        memcpy(&b, key + i, 8);
+        a ^= b;
+        memcpy(out + i, &a, 8);
+    }
+    for (; i < len; i++) {
+        out[i] = in[i] ^ key[i];
+    }
+}
+
+//XORs out = in ^ keystream[position ..] for as many leading bytes as the ring has ready and
+//returns that count; the caller computes the rest (bytes n .. len) itself. Either way the
+//ring is moved past position + len, so the producer starts on what comes after this message.
+//position must not be behind earlier calls (returns 0 and changes nothing if it is).
+size_t Keystream_Ring_Xor(keystream_ring *r, uint64_t position, unsigned char *out, const unsigned char *in, size_t len)
+{
+    uint64_t t = r->tail;                                                      //only this thread writes tail
+    if (position < t) {
+        return 0;
+    }
+    uint64_t h = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    size_t n = 0;
+    if (h > position) {
+        n = h - position < len ? (size_t)(h - position) : len;
+    }
+    size_t at = (size_t)(position % r->capacity);
+    size_t first = n < r->capacity - at ? n : r->capacity - at;
+    Keystream_Ring_Xor_Bytes(out, in, r->buffer + at, first);
+    Keystream_Ring_Xor_Bytes(out + first, in + first, r->buffer, n - first);  //wrapped part, if any
+    __atomic_store_n(&r->tail, position + len, __ATOMIC_SEQ_CST);              //done reading those slots
+    Keystream_Ring_Wake(r);
+    r->hitBytes += n;
+    r->missBytes += len - n;
+    return n;
+}
@@ -0,0 +1,58 @@
+//////////////////////
+//  Keystream Ring  //
+//////////////////////
+/***********************************************************************
+ *  Toy Steam Cipher Implementation   *
+ ***********************************************************************
+ *Description:  Background keystream precomputation for --prefetch.
+ 			A producer thread runs ahead of the consumer and keeps a ring
+ 			buffer of ready ChaCha20 keystream, so encrypting or decrypting
+ 			the next message is a ring read plus XOR instead of a
+ 			keystream computation on the critical path.
+ 			    - one producer (the ring's own thread), one consumer
+ 			    - head/tail are absolute keystream offsets, published with
+ 			      acquire/release atomics; no locks on the fast path
+ 			    - a producer facing a full ring sleeps on a condition variable
+ 			      and the consumer wakes it when it moves tail
+ 			    - the consumer may jump forward at any time (a Seek, or a
+ 			      message larger than what is buffered): it moves tail past
+ 			      the bytes it computes itself and the producer follows
+ 			    - capacity is both the lookahead depth and the memory cap
+
+ *Use:              keystream_ring r;
+ *                  Keystream_Ring_Start(&r, &keystream, 0, 4 << 20);     // 4 MiB ahead of byte 0
+ *                  n = Keystream_Ring_Xor(&r, position, out, in, len);   // first n bytes came from the ring
+ *                  Keystream_Ring_Stop(&r);
+_______________________________________________________________________________*/
+#ifndef KEYSTREAM_RING_H
+#define KEYSTREAM_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "chacha_kernel.h"
+
+#define KEYSTREAM_RING_BLOCK (16 * 1024)            // producer granularity; capacity is rounded up to it
+#define KEYSTREAM_RING_MAX   (256u * 1024 * 1024)   // hard memory cap for one ring
+
+typedef struct {
+    chacha_kernel_state keystream;      // producer's own copy, runs at `head`
+    unsigned char *buffer;              // byte N of the keystream lives at buffer[N % capacity]
+    size_t capacity;
+    uint64_t head;                      // keystream ready up to here (written by the producer)
+    uint64_t tail;                      // consumed up to here (written by the consumer)
+    int stopping;
+    pthread_t thread;
+    pthread_mutex_t lock;               // only guards the producer's sleep while the ring is full
+    pthread_cond_t space;               // signalled by the consumer when it frees slots
+    int producerWaiting;                // producer is (about to be) asleep on space
+    int canBlock;                       // lock/space are set up; otherwise the producer naps
+    unsigned long long hitBytes;        // consumer side: bytes served from the ring
+    unsigned long long missBytes;       // consumer side: bytes the caller had to compute itself
+} keystream_ring;
+
+int Keystream_Ring_Start(keystream_ring *r, const chacha_kernel_state *st, uint64_t position, size_t capacity);
+size_t Keystream_Ring_Xor(keystream_ring *r, uint64_t position, unsigned char *out, const unsigned char *in, size_t len);
+void Keystream_Ring_Stop(keystream_ring *r);
+
+#endif
@@ -0,0 +1,493 @@
+//////////////////////
+//     Load Gen     //
+//////////////////////
+/***********************************************************************
+ *  Toy Steam Cipher Implementation   *
+ ***********************************************************************
+ *Description:  Sustained-load / soak tester for bob --server.
+ 			--clients threads each act as an Alice with its own REQ socket
+ 			(the REQ/REP lock-step path: one message in flight per client):
+ 			    1. pick a message size from --size min:max (--dist log or uniform)
+ 			    2. wait for the message's scheduled send time (--rate is the
+ 			       total for all clients, 0 = closed loop, send as soon as
+ 			       the last ack is in)
+ 			    3. SHA-256 the plaintext, encrypt it at a keystream offset
+ 			       no other message uses, send [session_header][payload]
+ 			    4. wait for the ack and memcmp it against the SHA-256,
+ 			       the same check Alice makes
+ 			Send->ack latency goes into an HDR-style log-linear histogram
+ 			(~3% resolution from 1 ns to hours, no allocation while running).
+ 			How late a send was against its schedule is kept separately, so a
+ 			server that cannot keep up shows as schedule lag, not just as
+ 			fewer messages.
+ 			--sweep repeats the run, doubling --rate every step, until the
+ 			achieved rate falls under 90% of the offered rate or acks fail:
+ 			the last step that kept up is the saturation point.
+ 			Every step prints one JSON line on stdout; progress goes to stderr.
+
+ *Compile:          gcc -O2 loadgen.c toycipher.c chacha_kernel.c keystream_ring.c merkle.c hex.c stats.c pool.c compress.c writer.c -ltomcrypt -lzmq -lz -lpthread -lm -o loadgen
+ *
+ *Run example:      ./bob SharedSeed1.txt --server &                              (same seed on both sides)
+ *                  ./loadgen SharedSeed1.txt --clients 16 --rate 20000 --duration 30 --size 64:65536
+ *                  ./loadgen SharedSeed1.txt --clients 32 --rate 1000 --sweep --duration 5 > sweep.jsonl
+_______________________________________________________________________________*/
+
+//Header Files
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <libtomcrypt/tomcrypt.h>
+#include <zmq.h>
+#include "session.h"
+#include "toycipher.h"
+
+#define LOADGEN_CLIENTS     4
+#define LOADGEN_DURATION    10.0                    // default --duration, seconds per step
+#define LOADGEN_SIZE        1024                    // default --size
+#define LOADGEN_TIMEOUT_MS  2000                    // default --timeout: no ack by then counts as a timeout
+#define LOADGEN_MAX_CLIENTS 1024
+#define LOADGEN_KEEP_UP     0.9                     // --sweep stops once achieved < 90% of offered
+
+#define HIST_BITS    6                              // linear below 2^6 ns, then 32 buckets per power of two
+#define HIST_HALF    (1 << (HIST_BITS - 1))
+#define HIST_BUCKETS ((64 - HIST_BITS + 1) * HIST_HALF + HIST_HALF)
+
+typedef struct {
+    unsigned long long counts[HIST_BUCKETS];
+    unsigned long long total, min, max;             // nanoseconds
+    double sum;
+} latency_histogram;
+
+typedef struct {
+    int id;
+    pthread_t thread;
+    double interval;                                // seconds between this client's sends, 0 = closed loop
+    double started, deadline;                       // Now_Seconds()
+    unsigned int random;                            // size picker state
+    unsigned long long sent, acked, failures, timeouts, bytes;    // read by the progress report while running
+    latency_histogram latency;                      // send -> ack
+    latency_histogram lag;                          // actual send - scheduled send
+} loadgen_client;
+
+typedef struct {
+    double offered, achieved, mbPerSec, seconds;
+    unsigned long long sent, acked, failures, timeouts;
+    unsigned long long p99;
+} loadgen_result;
+
+//Function prototypes
+static double Now_Seconds(void);
+static void Histogram_Record(latency_histogram *h, unsigned long long ns);
+static void Histogram_Merge(latency_histogram *into, const latency_histogram *from);
+static unsigned long long Histogram_Percentile(const latency_histogram *h, double percentile);
+static void Histogram_Write(FILE *out, const latency_histogram *h);
+static void *Load_Client(void *arg);
+static loadgen_result Load_Step(double rate);
+
+static toycipher_ctx cipher;                        // keyed from the seed file, shared through Toy_Encrypt_At
+static void *zmqContext;
+static const char *endpoint = SESSION_ENDPOINT_CONNECT;
+static int clients = LOADGEN_CLIENTS;
+static double duration = LOADGEN_DURATION;
+static size_t sizeMin = LOADGEN_SIZE, sizeMax = LOADGEN_SIZE;
+static int logSizes = 1;                            // --dist log (default) or uniform
+static int timeoutMs = LOADGEN_TIMEOUT_MS;
+static int reportSeconds = 1;
+static const char *histogramFile;                   // --histogram: full latency distribution of the last step
+static uint64_t nextOffset;                         // keystream handed out so far, across all clients and steps
+static volatile sig_atomic_t load_stop = 0;
+
+static void Load_Signal(int sig)
+{
+    (void)sig;
+    load_stop = 1;
+}
+
+
+/*************************************************************
+						M A I N
+**************************************************************/
+int main (int argc, char* argv[])
+{
+    double rate = 0;
+    int sweep = 0;
+    int usage = argc < 2 || strncmp(argv[1], "--", 2) == 0;
+    for (int a = 2; a < argc && !usage; a++) {
+        if (strcmp(argv[a], "--clients") == 0 && a + 1 < argc) {
+            clients = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--rate") == 0 && a + 1 < argc) {
+            rate = atof(argv[++a]);
+        } else if (strcmp(argv[a], "--duration") == 0 && a + 1 < argc) {
+            duration = atof(argv[++a]);
+        } else if (strcmp(argv[a], "--size") == 0 && a + 1 < argc) {
+            char *colon;
+            sizeMin = sizeMax = strtoull(argv[++a], &colon, 10);
+            if (*colon == ':') {
+                sizeMax = strtoull(colon + 1, NULL, 10);
+            }
+        } else if (strcmp(argv[a], "--dist") == 0 && a + 1 < argc) {
+            logSizes = strcmp(argv[++a], "uniform") != 0;
+        } else if (strcmp(argv[a], "--endpoint") == 0 && a + 1 < argc) {
+            endpoint = argv[++a];
+        } else if (strcmp(argv[a], "--timeout") == 0 && a + 1 < argc) {
+            timeoutMs = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--report") == 0 && a + 1 < argc) {
+            reportSeconds = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--histogram") == 0 && a + 1 < argc) {
+            histogramFile = argv[++a];
+        } else if (strcmp(argv[a], "--sweep") == 0) {
+            sweep = 1;
+        } else {
+            usage = 1;
+        }
+    }
+    if (usage || clients < 1 || clients > LOADGEN_MAX_CLIENTS || sizeMin < 1 || sizeMax < sizeMin
+        || duration <= 0 || (sweep && rate <= 0)) {
+        printf("Usage: %s SharedSeed.txt [--clients n] [--rate msgs/s] [--duration seconds] [--size min[:max]]\n"
+               "       [--dist log|uniform] [--endpoint tcp://localhost:5555] [--timeout ms] [--report seconds]\n"
+               "       [--histogram file] [--sweep]      (--sweep needs a starting --rate)\n", argv[0]);
+        return 1;
+    }
+
+//---1. Key the cipher from the same seed bob --server was started with
+    int seed_length = 0;
+    unsigned char* seed = Read_File(argv[1], &seed_length); // "SharedSeed.txt"
+    Toy_Init(&cipher, seed, seed_length);
+    Pool_Free(seed);
+    zmqContext = zmq_ctx_new();
+    signal(SIGINT, Load_Signal);
+    signal(SIGTERM, Load_Signal);
+    fprintf(stderr, "loadgen: %d clients -> %s, %zu..%zu byte messages (%s)\n",
+            clients, endpoint, sizeMin, sizeMax, logSizes ? "log-uniform" : "uniform");
+
+//---2. One step at --rate, or a sweep doubling it until Bob stops keeping up
+    unsigned long long failed = 0;
+    loadgen_result saturation = { 0 };
+    for (;;) {
+        loadgen_result r = Load_Step(rate);
+        failed += r.failures + r.timeouts;
+        if (!sweep || load_stop) {
+            break;
+        }
+        if (r.achieved < r.offered * LOADGEN_KEEP_UP || r.failures + r.timeouts > 0) {
+            fprintf(stderr, "loadgen: saturated at %.0f msg/s offered (%.0f achieved)\n", r.offered, r.achieved);
+            break;
+        }
+        saturation = r;
+        rate *= 2;
+    }
+    if (sweep && saturation.acked > 0) {
+        printf("{\"saturation_msgs_per_s\":%.1f,\"saturation_mb_per_s\":%.2f,\"p99_us\":%.1f}\n",
+               saturation.achieved, saturation.mbPerSec, saturation.p99 / 1e3);
+    }
+
+//---3. Clean up
+    zmq_ctx_destroy(zmqContext);
+    Toy_Free(&cipher);
+    return failed == 0 ? 0 : 2;
+}
+
+/*************************************************************
+					F u n c t i o n s
+**************************************************************/
+/*============================
+          Clocks
+==============================*/
+static double Now_Seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*============================
+     Latency Histogram
+==============================*/
+//Log-linear buckets like HdrHistogram: values below 2^HIST_BITS get a bucket each, above that
+//every power of two is split into HIST_HALF equal buckets, so a bucket is never wider than
+//~3% of the values in it. Recording is an index computation and an increment.
+static int Histogram_Index(unsigned long long ns)
+{
+    if (ns < 2 * HIST_HALF) {
+        return (int) ns;
+    }
+    int shift = 63 - __builtin_clzll(ns) - (HIST_BITS - 1);
+    return shift * HIST_HALF + (int)(ns >> shift);
+}
+
+//Highest value that lands in bucket `index`.
+static unsigned long long Histogram_Value(int index)
+{
+    if (index < 2 * HIST_HALF) {
+        return index;
+    }
+    int shift = index / HIST_HALF - 1;
+    unsigned long long sub = index - shift * HIST_HALF;
+    return ((sub + 1) << shift) - 1;
+}
+
+static void Histogram_Record(latency_histogram *h, unsigned long long ns)
+{
+    h->counts[Histogram_Index(ns)]++;
+    if (h->total == 0 || ns < h->min) h->min = ns;
+    if (ns > h->max) h->max = ns;
+    h->total++;
+    h->sum += ns;
+}
+
+static void Histogram_Merge(latency_histogram *into, const latency_histogram *from)
+{
+    if (from->total == 0) {
+        return;
+    }
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        into->counts[i] += from->counts[i];
+    }
+    if (into->total == 0 || from->min < into->min) into->min = from->min;
+    if (from->max > into->max) into->max = from->max;
+    into->total += from->total;
+    into->sum += from->sum;
+}
+
+//Smallest bucket value that at least `percentile` % of the recorded values are <= to.
+static unsigned long long Histogram_Percentile(const latency_histogram *h, double percentile)
+{
+    if (h->total == 0) {
+        return 0;
+    }
+    unsigned long long wanted = (unsigned long long) ceil(h->total * percentile / 100.0), seen = 0;
+    if (wanted == 0) wanted = 1;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= wanted) {
+            unsigned long long value = Histogram_Value(i);
+            return value < h->max ? value : h->max;
+        }
+    }
+    return h->max;
+}
+
+//The whole distribution, one line per non-empty bucket, in the column layout of
+//HdrHistogram's percentile output so its plotting tools read it.
+static void Histogram_Write(FILE *out, const latency_histogram *h)
+{
+    fprintf(out, "%12s %14s %10s %14s\n\n", "Value(us)", "Percentile", "TotalCount", "1/(1-Percentile)");
+    unsigned long long seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        if (h->counts[i] == 0) {
+            continue;
+        }
+        seen += h->counts[i];
+        double fraction = (double) seen / h->total;
+        unsigned long long value = Histogram_Value(i) < h->max ? Histogram_Value(i) : h->max;
+        if (seen < h->total) {
+            fprintf(out, "%12.3f %14.12f %10llu %14.2f\n", value / 1e3, fraction, seen, 1.0 / (1.0 - fraction));
+        } else {
+            fprintf(out, "%12.3f %14.12f %10llu %14s\n", value / 1e3, fraction, seen, "inf");
+        }
+    }
+    fprintf(out, "#[Mean = %.3f, Max = %.3f, Total count = %llu]\n",
+            h->total ? h->sum / h->total / 1e3 : 0.0, h->max / 1e3, h->total);
+}
+
+/*============================
+          One Client
+==============================*/
+static void *Load_Socket(void)
+{
+    void *requester = zmq_socket(zmqContext, ZMQ_REQ);
+    int linger = 0;
+    zmq_setsockopt(requester, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_setsockopt(requester, ZMQ_RCVTIMEO, &timeoutMs, sizeof(timeoutMs));
+    zmq_connect(requester, endpoint);
+    return requester;
+}
+
+static size_t Load_Pick_Size(loadgen_client *c)
+{
+    if (sizeMax == sizeMin) {
+        return sizeMin;
+    }
+    double u = rand_r(&c->random) / ((double) RAND_MAX + 1);
+    size_t size;
+    if (logSizes) {                                                            //as many 64-128 B messages as 64-128 KiB ones
+        size = (size_t) exp(log((double) sizeMin) + u * (log((double) sizeMax + 1) - log((double) sizeMin)));
+    } else {
+        size = sizeMin + (size_t)(u * (sizeMax - sizeMin + 1));
+    }
+    return size > sizeMax ? sizeMax : size;                                    //exp/log can round up to sizeMax + 1
+}
+
+//An Alice in REQ/REP lock-step. A REQ socket that timed out cannot send again, so it is
+//replaced (the lazy-pirate pattern); Bob's late ack then goes nowhere.
+static void *Load_Client(void *arg)
+{
+    loadgen_client *c = (loadgen_client*) arg;
+    unsigned char *plaintext = (unsigned char*) malloc(sizeMax);
+    if (plaintext == NULL) {
+        printf("Client %d: cannot allocate %zu bytes\n", c->id, sizeMax);
+        return NULL;
+    }
+    for (size_t i = 0; i < sizeMax; i++) {
+        plaintext[i] = (unsigned char) rand_r(&c->random);
+    }
+    void *requester = Load_Socket();
+
+    for (unsigned long long k = 0; !load_stop; k++) {
+        double scheduled = c->started + k * c->interval, now = Now_Seconds();
+        if (scheduled >= c->deadline || now >= c->deadline) {
+            break;
+        }
+        if (c->interval > 0 && scheduled > now) {                              //open loop: wait for our slot
+            struct timespec wait;
+            double ahead = scheduled - now;
+            wait.tv_sec = (time_t) ahead;
+            wait.tv_nsec = (long)((ahead - wait.tv_sec) * 1e9);
+            nanosleep(&wait, NULL);
+        }
+
+        size_t len = Load_Pick_Size(c);
+        unsigned char digest[32], ack[32];
+        hash_state md;
+        sha256_init(&md);
+        sha256_process(&md, plaintext, len);
+        sha256_done(&md, digest);
+        session_header hdr = { SESSION_MAGIC, SESSION_DATA, k, __atomic_fetch_add(&nextOffset, len, __ATOMIC_RELAXED), len };
+        zmq_msg_t payload;
+        Toy_Msg_Init(&payload, len);
+        Toy_Encrypt_At(&cipher, hdr.offset, zmq_msg_data(&payload), plaintext, len);
+
+        double sentAt = Now_Seconds();
+        if (c->interval > 0) {
+            Histogram_Record(&c->lag, sentAt > scheduled ? (unsigned long long)((sentAt - scheduled) * 1e9) : 0);
+        }
+        zmq_send(requester, &hdr, sizeof(hdr), ZMQ_SNDMORE);
+        zmq_msg_send(&payload, requester, 0);
+        __atomic_fetch_add(&c->sent, 1, __ATOMIC_RELAXED);
+
+        session_header reply;
+        int got = zmq_recv(requester, &reply, sizeof(reply), 0);
+        if (got < 0) {                                                         //no ack within --timeout
+            __atomic_fetch_add(&c->timeouts, 1, __ATOMIC_RELAXED);
+            zmq_close(requester);
+            requester = Load_Socket();
+            continue;
+        }
+        int hashLen = 0, more = 1;
+        size_t moreLen = sizeof(more);
+        for (int part = 0; zmq_getsockopt(requester, ZMQ_RCVMORE, &more, &moreLen) == 0 && more; part++) {
+            int n = zmq_recv(requester, ack, sizeof(ack), 0);                  //REQ must read the whole reply
+            if (part == 0) hashLen = n;
+        }
+        double ackedAt = Now_Seconds();
+        Histogram_Record(&c->latency, (unsigned long long)((ackedAt - sentAt) * 1e9));
+        if (got != sizeof(reply) || reply.type != SESSION_ACK || reply.seq != k || hashLen != 32
+            || memcmp(ack, digest, 32) != 0) {
+            __atomic_fetch_add(&c->failures, 1, __ATOMIC_RELAXED);
+        } else {
+            __atomic_fetch_add(&c->acked, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&c->bytes, len, __ATOMIC_RELAXED);
+        }
+    }
+    zmq_close(requester);
+    free(plaintext);
+    return NULL;
+}
+
+/*============================
+          One Step
+==============================*/
+//Runs every client for --duration seconds at `rate` messages/s in total (0 = closed loop),
+//reporting progress to stderr, then prints the step's JSON line and returns its numbers.
+static loadgen_result Load_Step(double rate)
+{
+    loadgen_client *all = (loadgen_client*) calloc(clients, sizeof(loadgen_client));
+    latency_histogram *latency = (latency_histogram*) calloc(1, sizeof(latency_histogram));
+    latency_histogram *lag = (latency_histogram*) calloc(1, sizeof(latency_histogram));
+    if (all == NULL || latency == NULL || lag == NULL) {
+        printf("Out of memory for %d clients\n", clients);
+        exit(1);
+    }
+    double started = Now_Seconds();
+    for (int i = 0; i < clients; i++) {
+        all[i].id = i;
+        all[i].interval = rate > 0 ? clients / rate : 0;
+        all[i].started = started + (rate > 0 ? i / rate : 0);                  //spread the clients over one interval
+        all[i].deadline = started + duration;
+        all[i].random = 0x9e3779b9u * (i + 1);
+        if (pthread_create(&all[i].thread, NULL, Load_Client, &all[i]) != 0) {
+            printf("Could not start client %d\n", i);
+            exit(1);
+        }
+    }
+
+    unsigned long long reported = 0;
+    double lastReport = started;
+    while (!load_stop && Now_Seconds() < started + duration) {
+        usleep(50000);
+        double now = Now_Seconds();
+        if (reportSeconds > 0 && now - lastReport >= reportSeconds) {
+            unsigned long long acked = 0, failures = 0, timeouts = 0;
+            for (int i = 0; i < clients; i++) {
+                acked += __atomic_load_n(&all[i].acked, __ATOMIC_RELAXED);
+                failures += __atomic_load_n(&all[i].failures, __ATOMIC_RELAXED);
+                timeouts += __atomic_load_n(&all[i].timeouts, __ATOMIC_RELAXED);
+            }
+            fprintf(stderr, "[loadgen] %.0f msg/s acked (offered %.0f), %llu failures, %llu timeouts\n",
+                    (acked - reported) / (now - lastReport), rate, failures, timeouts);
+            reported = acked;
+            lastReport = now;
+        }
+    }
+
+    loadgen_result r = { 0 };
+    unsigned long long bytes = 0;
+    for (int i = 0; i < clients; i++) {
+        pthread_join(all[i].thread, NULL);
+        r.sent += all[i].sent;
+        r.acked += all[i].acked;
+        r.failures += all[i].failures;
+        r.timeouts += all[i].timeouts;
+        bytes += all[i].bytes;
+        Histogram_Merge(latency, &all[i].latency);
+        Histogram_Merge(lag, &all[i].lag);
+    }
+    r.seconds = Now_Seconds() - started;
+    r.offered = rate;
+    r.achieved = r.acked / r.seconds;
+    r.mbPerSec = bytes / r.seconds / 1e6;
+    r.p99 = Histogram_Percentile(latency, 99);
+
+    printf("{\"clients\":%d,\"offered_msgs_per_s\":%.1f,\"seconds\":%.3f,\"size_min\":%zu,\"size_max\":%zu,"
+           "\"dist\":\"%s\",\"sent\":%llu,\"acked\":%llu,\"failures\":%llu,\"timeouts\":%llu,"
+           "\"msgs_per_s\":%.1f,\"mb_per_s\":%.2f,"
+           "\"latency_us\":{\"min\":%.1f,\"mean\":%.1f,\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f},"
+           "\"schedule_lag_us\":{\"p50\":%.1f,\"p99\":%.1f,\"max\":%.1f}}\n",
+           clients, rate, r.seconds, sizeMin, sizeMax, logSizes ? "log" : "uniform",
+           r.sent, r.acked, r.failures, r.timeouts, r.achieved, r.mbPerSec,
+           latency->min / 1e3, latency->total ? latency->sum / latency->total / 1e3 : 0.0,
+           Histogram_Percentile(latency, 50) / 1e3, Histogram_Percentile(latency, 90) / 1e3,
+           r.p99 / 1e3, Histogram_Percentile(latency, 99.9) / 1e3, latency->max / 1e3,
+           Histogram_Percentile(lag, 50) / 1e3, Histogram_Percentile(lag, 99) / 1e3, lag->max / 1e3);
+    fflush(stdout);
+
+    if (histogramFile) {                                                       //overwritten each step: the last one stays
+        FILE *out = fopen(histogramFile, "w");
+        if (out == NULL) {
+            printf("Cannot write %s\n", histogramFile);
+        } else {
+            Histogram_Write(out, latency);
+            fclose(out);
+        }
+    }
+    free(all);
+    free(latency);
+    free(lag);
+    return r;
+}
+//__________________________________________________________________________________________________________________________
@@ -0,0 +1,228 @@
+//////////////////////
+//   Merkle Tree    //
+//////////////////////
+/***********************************************************************
+ *  Toy Steam Cipher Implementation   *
+ ***********************************************************************
+ *Description:  Builds the Merkle tree described in merkle.h.
+ 			1. Leaves are split into one contiguous range per thread and
+ 			   hashed with LibTomCrypt's SHA-256 in parallel.
+ 			2. The levels above the leaves are a few percent of the work
+ 			   and are hashed on the calling thread.
+
+ *Compile:          gcc -c merkle.c             (link -ltomcrypt -lpthread)
+_______________________________________________________________________________*/
+
+//Header Files
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <libtomcrypt/tomcrypt.h>
+#include "merkle.h"
+
+#define MERKLE_MAX_THREADS 64
+
+typedef struct {
+    const unsigned char *data;
+    size_t len;
+    size_t leafSize;
+    size_t first, last;                   // leaves [first, last)
+    unsigned char (*out)[32];
+} merkle_job;
+
+/*============================
+        Node Hashes
+==============================*/
+static void Merkle_Hash_Leaf(const unsigned char *chunk, size_t len, unsigned char out[32])
+{
+    hash_state md;
+    unsigned char tag = 0x00;
+    sha256_init(&md);
+    sha256_process(&md, &tag, 1);
+    sha256_process(&md, chunk, len);
+    sha256_done(&md, out);
+}
+
+static void Merkle_Hash_Inner(const unsigned char left[32], const unsigned char right[32], unsigned char out[32])
+{
+    hash_state md;
+    unsigned char tag = 0x01;
+    sha256_init(&md);
+    sha256_process(&md, &tag, 1);
+    sha256_process(&md, left, 32);
+    sha256_process(&md, right, 32);
+    sha256_done(&md, out);
+}
+
+static void *Merkle_Leaf_Worker(void *arg)
+{
+    merkle_job *job = (merkle_job*) arg;
+    for (size_t i = job->first; i < job->last; i++) {
+        size_t start = i * job->leafSize;
+        size_t n = job->len > start ? job->len - start : 0;
+        if (n > job->leafSize) {
+            n = job->leafSize;
+        }
+        Merkle_Hash_Leaf(job->data + start, n, job->out[i]);
+    }
+    return NULL;
+}
+
+/*============================
+        Tree Layout
+==============================*/
+static size_t Merkle_Node_Count(size_t leaves)
+{
+    size_t nodes = 0;
+    for (size_t level = leaves; ; level = (level + 1) / 2) {
+        nodes += level;
+        if (level == 1) {
+            break;
+        }
+    }
+    return nodes;
+}
+
+//Fills every level above the leaves, which must already be in t->hash[0 .. leaves).
+static void Merkle_Hash_Levels(merkle_tree *t)
+{
+    size_t base = 0;
+    for (size_t level = t->leaves; level > 1; level = (level + 1) / 2) {
+        size_t up = base + level;
+        for (size_t i = 0; i < level / 2; i++) {
+            Merkle_Hash_Inner(t->hash[base + 2 * i], t->hash[base + 2 * i + 1], t->hash[up + i]);
+        }
+        if (level % 2) {                                                       //odd one out is carried up as is
+            memcpy(t->hash[up + level / 2], t->hash[base + level - 1], 32);
+        }
+        base = up;
+    }
+}
+
+static int Merkle_Alloc(merkle_tree *t, size_t leaves, size_t leafSize)
+{
+    t->leafSize = leafSize;
+    t->leaves = leaves > 0 ? leaves : 1;
+    t->nodes = Merkle_Node_Count(t->leaves);
+    t->hash = malloc(t->nodes * 32);
+    if (t->hash == NULL) {
+        printf("Out of memory for the Merkle tree\n");
+        return 0;
+    }
+    return 1;
+}
+
+/*============================
+         Build Tree
+==============================*/
+//threads <= 0 means one per CPU. Returns 1 on success.
+int Merkle_Build(merkle_tree *t, const unsigned char *data, size_t len, size_t leafSize, int threads)
+{
+    if (leafSize == 0) {
+        leafSize = MERKLE_LEAF_SIZE;
+    }
+    if (!Merkle_Alloc(t, (len + leafSize - 1) / leafSize, leafSize)) {
+        return 0;
+    }
+    if (threads <= 0) {
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (threads > MERKLE_MAX_THREADS) {
+        threads = MERKLE_MAX_THREADS;
+    }
+    if ((size_t)threads > t->leaves) {
+        threads = (int)t->leaves;
+    }
+
+    pthread_t tids[MERKLE_MAX_THREADS];
+    merkle_job jobs[MERKLE_MAX_THREADS];
+    int running[MERKLE_MAX_THREADS] = {0};
+    for (int w = 0; w < threads; w++) {
+        jobs[w].data = data;
+        jobs[w].len = len;
+        jobs[w].leafSize = leafSize;
+        jobs[w].first = t->leaves * w / threads;
+        jobs[w].last = t->leaves * (w + 1) / threads;
+        jobs[w].out = t->hash;
+        if (w > 0) {
+            running[w] = pthread_create(&tids[w], NULL, Merkle_Leaf_Worker, &jobs[w]) == 0;
+        }
+    }
+    for (int w = 0; w < threads; w++) {                                        //range 0, and any thread that failed to start, run here
+        if (!running[w]) {
+            Merkle_Leaf_Worker(&jobs[w]);
+        }
+    }
+    for (int w = 1; w < threads; w++) {
+        if (running[w]) {
+            pthread_join(tids[w], NULL);
+        }
+    }
+    Merkle_Hash_Levels(t);
+    return 1;
+}
+
+//Rebuilds a tree from leaf hashes received from the other side.
+int Merkle_From_Leaves(merkle_tree *t, const unsigned char (*leaves)[32], size_t count, size_t leafSize)
+{
+    if (count == 0 || !Merkle_Alloc(t, count, leafSize)) {
+        return 0;
+    }
+    memcpy(t->hash, leaves, count * 32);
+    Merkle_Hash_Levels(t);
+    return 1;
+}
+
+const unsigned char *Merkle_Root(const merkle_tree *t)
+{
+    return t->hash[t->nodes - 1];
+}
+
+/*============================
+          Tree Diff
+==============================*/
+//Collects (at most `max`) indices of leaves that differ, visiting only subtrees whose
+//hashes differ. Both trees must have the same number of leaves. Returns the count found.
+static void Merkle_Diff_Node(const merkle_tree *a, const merkle_tree *b, const size_t *base, const size_t *width,
+                             int level, size_t index, uint64_t *failing, size_t max, size_t *found)
+{
+    if (*found >= max || memcmp(a->hash[base[level] + index], b->hash[base[level] + index], 32) == 0) {
+        return;
+    }
+    if (level == 0) {
+        failing[(*found)++] = index;
+        return;
+    }
+    Merkle_Diff_Node(a, b, base, width, level - 1, 2 * index, failing, max, found);
+    if (2 * index + 1 < width[level - 1]) {
+        Merkle_Diff_Node(a, b, base, width, level - 1, 2 * index + 1, failing, max, found);
+    }
+}
+
+size_t Merkle_Diff(const merkle_tree *mine, const merkle_tree *theirs, uint64_t *failing, size_t max)
+{
+    size_t base[64], width[64], found = 0;
+    int levels = 0;
+    if (mine->leaves != theirs->leaves) {
+        return 0;
+    }
+    for (size_t level = mine->leaves, at = 0; ; level = (level + 1) / 2) {
+        base[levels] = at;
+        width[levels] = level;
+        levels++;
+        at += level;
+        if (level == 1) {
+            break;
+        }
+    }
+    Merkle_Diff_Node(mine, theirs, base, width, levels - 1, 0, failing, max, &found);
+    return found;
+}
+
+void Merkle_Free(merkle_tree *t)
+{
+    free(t->hash);
+    t->hash = NULL;
+}
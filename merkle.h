@@ -0,0 +1,43 @@
+//////////////////////
+//   Merkle Tree    //
+//////////////////////
+/***********************************************************************
+ *  Toy Steam Cipher Implementation   *
+ ***********************************************************************
+ *Description:  Chunked SHA-256 Merkle tree for the --merkle acknowledgement.
+ 			The message is cut into fixed-size leaves that are hashed in
+ 			parallel; pairs of nodes are hashed upwards to a single root.
+ 			    leaf  = SHA-256(0x00 || chunk)
+ 			    inner = SHA-256(0x01 || left || right)
+ 			A node without a sibling is carried up unchanged.
+ 			Merkle_Diff walks two trees from the root and only descends
+ 			where they differ, so it names the corrupted chunks.
+
+ *Use:              merkle_tree t;
+ *                  Merkle_Build(&t, data, len, MERKLE_LEAF_SIZE, 0);   // 0 = one thread per CPU
+ *                  Merkle_Root(&t);
+ *                  Merkle_Free(&t);
+_______________________________________________________________________________*/
+#ifndef MERKLE_H
+#define MERKLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MERKLE_LEAF_SIZE  (1024 * 1024)   // default chunk per leaf
+#define MERKLE_MAX_REPORT 1024            // failing leaves Bob reports at most
+
+typedef struct {
+    size_t leafSize;
+    size_t leaves;                        // always >= 1, an empty message has one empty leaf
+    size_t nodes;                         // all levels together
+    unsigned char (*hash)[32];            // leaves first, then each level up, root last
+} merkle_tree;
+
+int Merkle_Build(merkle_tree *t, const unsigned char *data, size_t len, size_t leafSize, int threads);
+int Merkle_From_Leaves(merkle_tree *t, const unsigned char (*leaves)[32], size_t count, size_t leafSize);
+const unsigned char *Merkle_Root(const merkle_tree *t);
+size_t Merkle_Diff(const merkle_tree *mine, const merkle_tree *theirs, uint64_t *failing, size_t max);
+void Merkle_Free(merkle_tree *t);
+
+#endif
@@ -0,0 +1,144 @@
+//////////////////////
+//   Buffer Pool    //
+//////////////////////
+/***********************************************************************
+ *  Toy Steam Cipher Implementation   *
+ ***********************************************************************
+ *Description:  Size-class buffer pool (pool.h).
+ 			1. Every buffer is preceded by a POOL_ALIGN-byte header holding
+ 			   its class, so Pool_Free needs no size.
+ 			2. A class is a mutex-protected free list; the lock is only
+ 			   held to push or pop one buffer.
+ 			3. A buffer over its class's cache limit is freed on the spot.
+
+ *Compile:          gcc -c pool.c     (part of libtoycipher, see toycipher.h)
+_______________________________________________________________________________*/
+
+//Header Files
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "pool.h"
+#include "stats.h"
+
+#define POOL_CLASSES   (POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+#define POOL_HUGE      -1                       // class of a buffer too big to pool
+
+typedef struct pool_header {
+    struct pool_header *next;                   // free list link while the buffer is pooled
+    int cls;                                    // index into classes[], or POOL_HUGE
+} pool_header;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pool_header *free;
+    size_t cached;                              // buffers on the free list
+} pool_class;
+
+static pool_class classes[POOL_CLASSES] = {
+    [0 ... POOL_CLASSES - 1] = { PTHREAD_MUTEX_INITIALIZER, NULL, 0 }
+};
+
+static size_t Pool_Class_Size(int cls)
+{
+    return (size_t)1 << (cls + POOL_MIN_SHIFT);
+}
+
+//Buffers a class may keep cached: POOL_CLASS_BYTES worth, but never fewer than POOL_CLASS_MIN.
+static size_t Pool_Class_Limit(int cls)
+{
+    size_t limit = POOL_CLASS_BYTES / Pool_Class_Size(cls);
+    return limit < POOL_CLASS_MIN ? POOL_CLASS_MIN : limit;
+}
+
+static pool_header *Pool_Heap(size_t size, int cls)
+{
+    void *block = NULL;
+    if (size > SIZE_MAX - POOL_ALIGN                                            //the header would wrap the size
+        || posix_memalign(&block, POOL_ALIGN, POOL_ALIGN + size) != 0) {
+        printf("Out of memory for a %zu byte buffer\n", size);
+        return NULL;
+    }
+    Stats_Count(STATS_POOL_HEAP, 1);
+    pool_header *h = (pool_header*) block;
+    h->cls = cls;
+    return h;
+}
+
+/*============================
+        Alloc / Free
+==============================*/
+//Returns a POOL_ALIGN-aligned buffer of at least `size` bytes, reused when one of its class is
+//free. NULL (after printing why) when the heap is exhausted.
+void *Pool_Alloc(size_t size)
+{
+    int cls = size <= Pool_Class_Size(0) ? 0 : 64 - __builtin_clzll(size - 1) - POOL_MIN_SHIFT;   //round up to a power of two
+    pool_header *h = NULL;
+    if (cls >= POOL_CLASSES) {
+        h = Pool_Heap(size, POOL_HUGE);
+    } else {
+        pool_class *c = &classes[cls];
+        pthread_mutex_lock(&c->lock);
+        h = c->free;
+        if (h) {
+            c->free = h->next;
+            c->cached--;
+        }
+        pthread_mutex_unlock(&c->lock);
+        if (h) {
+            Stats_Count(STATS_POOL_REUSED, 1);
+        } else {
+            h = Pool_Heap(Pool_Class_Size(cls), cls);
+        }
+    }
+    return h ? (unsigned char*) h + POOL_ALIGN : NULL;
+}
+
+void Pool_Free(void *buffer)
+{
+    if (buffer == NULL) {
+        return;
+    }
+    pool_header *h = (pool_header*)((unsigned char*) buffer - POOL_ALIGN);
+    if (h->cls != POOL_HUGE) {
+        pool_class *c = &classes[h->cls];
+        pthread_mutex_lock(&c->lock);
+        int keep = c->cached < Pool_Class_Limit(h->cls);
+        if (keep) {
+            h->next = c->free;
+            c->free = h;
+            c->cached++;
+        }
+        pthread_mutex_unlock(&c->lock);
+        if (keep) {
+            return;
+        }
+    }
+    free(h);
+}
+
+//zmq_free_fn for zmq_msg_init_data: ZeroMQ calls it once the message has been sent or closed.
+void Pool_Free_Msg(void *data, void *hint)
+{
+    (void)hint;
+    Pool_Free(data);
+}
+
+//Hands every cached buffer back to the heap.
+void Pool_Trim(void)
+{
+    for (int cls = 0; cls < POOL_CLASSES; cls++) {
+        pool_class *c = &classes[cls];
+        pthread_mutex_lock(&c->lock);
+        pool_header *h = c->free;
+        c->free = NULL;
+        c->cached = 0;
+        pthread_mutex_unlock(&c->lock);
+        while (h) {
+            pool_header *next = h->next;
+            free(h);
+            h = next;
+        }
+    }
+}
@@ -0,0 +1,42 @@
+//////////////////////
+//   Buffer Pool    //
+//////////////////////
+/***********************************************************************
+ *  Toy Steam Cipher Implementation   *
+ ***********************************************************************
+ *Description:  Reusable, cache-line aligned buffers for keys, ciphertext, hashes
+ 			and ZeroMQ payloads, so a long-running session stops going to
+ 			the heap once it has warmed up.
+ 			    - one size class per power of two, 64 B .. 64 MiB; a request
+ 			      gets the smallest class that fits
+ 			    - freed buffers go back on their class's free list and the
+ 			      next request of that class reuses them
+ 			    - each class caches at most POOL_CLASS_BYTES (and at least
+ 			      POOL_CLASS_MIN buffers); the rest go back to the heap, so
+ 			      memory stays flat after a burst
+ 			    - anything over 64 MiB comes straight from the heap
+ 			    - any thread may free a buffer another thread allocated
+ 			      (ZeroMQ's I/O thread does, through Pool_Free_Msg)
+ 			Reused vs. heap allocations are counted in stats.c.
+
+ *Use:              unsigned char *buf = Pool_Alloc(len);        // 64-byte aligned, contents undefined
+ *                  Pool_Free(buf);
+ *                  zmq_msg_init_data(&msg, Pool_Alloc(len), len, Pool_Free_Msg, NULL);   // or Toy_Msg_Init
+_______________________________________________________________________________*/
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+#define POOL_ALIGN       64                     // buffer alignment, also the size of the hidden header
+#define POOL_MIN_SHIFT   6                      // smallest class: 64 B
+#define POOL_MAX_SHIFT   26                     // largest class: 64 MiB
+#define POOL_CLASS_BYTES (64u * 1024 * 1024)    // most memory one class keeps cached
+#define POOL_CLASS_MIN   2                      // buffers a class may always keep, however large
+
+void *Pool_Alloc(size_t size);
+void Pool_Free(void *buffer);
+void Pool_Free_Msg(void *data, void *hint);
+void Pool_Trim(void);
+
+#endif
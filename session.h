@@ -0,0 +1,78 @@
+//////////////////////
+//  Session Frames  //
+//////////////////////
+/***********************************************************************
+ *  Toy Steam Cipher Implementation   *
+ ***********************************************************************
+ *Description:  Wire format for the long-lived Alice <-> Bob session (--session).
+ 			Alice keeps one DEALER socket connected to Bob's ROUTER on port
+ 			5555 for the whole run. Every ZeroMQ message is
+ 				[session_header][payload]
+ 			and several DATA messages may be in flight at once; Bob answers
+ 			each with an ACK carrying the same seq and the SHA-256 of the
+ 			plaintext, so Alice matches acks by sequence number instead of
+ 			waiting in REQ/REP lock-step. A DATA message whose ack is late is
+ 			sent again unchanged (same seq and offset); Bob keeps a bitmap of
+ 			the seqs he has served and acks a repeat again without writing it
+ 			twice.
+
+ 			The keystream runs on across the whole session: `offset` says
+ 			where in the keystream the payload starts, and Bob seeks there
+ 			(chacha_kernel.c), so messages never reuse keystream bytes.
+
+ 			--resume reuses the same frames for one large message: seq is the
+ 			chunk number and offset its byte position, so a chunk can be
+ 			resent on its own. Alice's END carries the total length in
+ 			`offset`; Bob's END reply carries the SHA-256 of the whole file.
+
+ 			--batch sends BATCH frames: a DATA frame whose keystream is that of
+ 			seed number `seq` in the manifest both sides loaded (toycipher.c,
+ 			Toy_Batch_Load), starting at `offset` (0, each pair is a message of
+ 			its own). Bob acks it like DATA. Alice's END closes the batch.
+
+ 			With --compress (compress.c) Alice may deflate a DATA payload
+ 			before encrypting it and sets SESSION_DEFLATE in `flags`: `length`
+ 			is then the deflated size (the keystream bytes used, from
+ 			`offset`) and `plain` the size it inflates to. Bob decrypts,
+ 			inflates and acks the hash of the inflated plaintext. A payload
+ 			without the flag is the ciphertext of the plaintext itself, so
+ 			either end may decide per message and a peer that never
+ 			compresses needs no option.
+
+ 			Both ends run on the same machine/architecture, so the header is
+ 			sent in host byte order.
+_______________________________________________________________________________*/
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdint.h>
+
+#define SESSION_MAGIC    0x31435354u   // "TSC1"
+#define SESSION_ENDPOINT_BIND    "tcp://*:5555"           // default data channel (--endpoint overrides it)
+#define SESSION_ENDPOINT_CONNECT "tcp://localhost:5555"
+#define ACK_ENDPOINT_BIND        "tcp://*:5556"           // default ack channel (--ack-endpoint overrides it)
+#define ACK_ENDPOINT_CONNECT     "tcp://localhost:5556"
+#define SESSION_WINDOW   16            // default number of unacknowledged messages
+#define RESUME_CHUNK_SIZE (1024 * 1024) // default --chunk for --resume (Bob bounds inflated chunks by it)
+
+enum session_type {
+    SESSION_DATA = 1,                  // Alice -> Bob: ciphertext payload
+    SESSION_ACK  = 2,                  // Bob -> Alice: 32-byte SHA-256 of the plaintext
+    SESSION_END  = 3,                  // either way: no more messages, close the session (--resume: Bob adds the file hash)
+    SESSION_BATCH = 4                  // Alice -> Bob: ciphertext of manifest pair `seq`, under that pair's seed
+};
+
+#define SESSION_DEFLATE  0x1           // flags: DATA payload was deflated before encryption
+
+typedef struct {
+    uint32_t magic;
+    uint32_t type;                     // enum session_type
+    uint64_t seq;                      // message number within the session
+    uint64_t offset;                   // keystream offset of payload byte 0
+    uint64_t length;                   // payload bytes
+    uint64_t plain;                    // SESSION_DEFLATE: plaintext bytes once inflated
+    uint32_t flags;                    // SESSION_DEFLATE, or 0 for a raw payload
+    uint32_t reserved;                 // 0, keeps the header free of padding
+} session_header;
+
+#endif
@@ -0,0 +1,191 @@
+//////////////////////
+//   Stage Stats    //
+//////////////////////
+/***********************************************************************
+ *  Toy Steam Cipher Implementation   *
+ ***********************************************************************
+ *Description:  Per-thread stage timing and counters (stats.h).
+ 			1. A thread's first Stats_Stage/Stats_Count claims a slot; after
+ 			   that it only ever adds into its own slot.
+ 			2. The owner is the only writer of a slot, so an add is a plain
+ 			   load and a relaxed store; Stats_Json may read while it runs.
+ 			3. Ticks become nanoseconds at dump time, measured against
+ 			   CLOCK_MONOTONIC over the life of the process.
+
+ *Compile:          gcc -c stats.c     (part of libtoycipher, see toycipher.h)
+_______________________________________________________________________________*/
+
+//Header Files
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "stats.h"
+
+#define STATS_CALIBRATE_NS 20000000     // ticks are timed against at least 20 ms of wall clock
+
+typedef struct {
+    uint64_t ticks[STATS_STAGES];
+    uint64_t calls[STATS_STAGES];
+    uint64_t bytes[STATS_STAGES];
+    uint64_t counters[STATS_COUNTERS];
+} __attribute__((aligned(64))) stats_slot;    // own cache line(s): threads never write the same line
+
+static stats_slot slots[STATS_MAX_THREADS + 1];   // the last one is shared by threads past the limit
+static unsigned int slotsUsed;
+static __thread stats_slot *mine;
+static uint64_t startTicks, startNs;
+static const char *exitPath, *exitProgram;
+
+static const char *stageNames[STATS_STAGES] = {
+    "read", "keygen", "xor", "decrypt_hash", "hex_dump", "send", "receive", "ack_wait", "hash", "compare", "write",
+    "compress", "decompress"
+};
+static const char *counterNames[STATS_COUNTERS] = {
+    "messages_sent", "bytes_sent", "messages_received", "bytes_received", "acks_ok", "acks_failed",
+    "pool_reused", "pool_heap", "compress_bypassed"
+};
+
+static uint64_t Stats_Now_Ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+__attribute__((constructor)) static void Stats_Start(void)
+{
+    startTicks = Stats_Clock();
+    startNs = Stats_Now_Ns();
+}
+
+/*============================
+          Recording
+==============================*/
+#ifndef TOY_NO_STATS
+static stats_slot *Stats_Slot(void)
+{
+    if (mine == NULL) {
+        unsigned int i = __atomic_fetch_add(&slotsUsed, 1, __ATOMIC_RELAXED);
+        mine = &slots[i < STATS_MAX_THREADS ? i : STATS_MAX_THREADS];
+    }
+    return mine;
+}
+
+static void Stats_Add(stats_slot *s, uint64_t *field, uint64_t n)
+{
+    if (s == &slots[STATS_MAX_THREADS]) {
+        __atomic_fetch_add(field, n, __ATOMIC_RELAXED);
+    } else {
+        __atomic_store_n(field, *field + n, __ATOMIC_RELAXED);                 //single writer: no locked add needed
+    }
+}
+
+//Adds the time since `started` (a Stats_Clock() value) and `bytes` to `stage`.
+void Stats_Stage(int stage, uint64_t started, uint64_t bytes)
+{
+    uint64_t ticks = Stats_Clock() - started;
+    stats_slot *s = Stats_Slot();
+    Stats_Add(s, &s->ticks[stage], ticks);
+    Stats_Add(s, &s->calls[stage], 1);
+    Stats_Add(s, &s->bytes[stage], bytes);
+}
+
+void Stats_Count(int counter, uint64_t n)
+{
+    stats_slot *s = Stats_Slot();
+    Stats_Add(s, &s->counters[counter], n);
+}
+#endif
+
+/*============================
+          Reporting
+==============================*/
+//Sums every slot into one JSON object (no newline) in out[size]. Returns its length, or 0
+//if it did not fit.
+size_t Stats_Json(char *out, size_t size, const char *program)
+{
+    uint64_t ticks[STATS_STAGES] = {0}, calls[STATS_STAGES] = {0}, bytes[STATS_STAGES] = {0};
+    uint64_t counters[STATS_COUNTERS] = {0};
+    unsigned int used = __atomic_load_n(&slotsUsed, __ATOMIC_RELAXED);
+    unsigned int last = used > STATS_MAX_THREADS ? STATS_MAX_THREADS : used - (used > 0);   //shared slot only once overflowing
+    for (unsigned int i = 0; used > 0 && i <= last; i++) {
+        for (int k = 0; k < STATS_STAGES; k++) {
+            ticks[k] += __atomic_load_n(&slots[i].ticks[k], __ATOMIC_RELAXED);
+            calls[k] += __atomic_load_n(&slots[i].calls[k], __ATOMIC_RELAXED);
+            bytes[k] += __atomic_load_n(&slots[i].bytes[k], __ATOMIC_RELAXED);
+        }
+        for (int k = 0; k < STATS_COUNTERS; k++) {
+            counters[k] += __atomic_load_n(&slots[i].counters[k], __ATOMIC_RELAXED);
+        }
+    }
+
+    uint64_t elapsedNs = Stats_Now_Ns() - startNs;
+#if defined(__x86_64__) || defined(__i386__)
+    if (elapsedNs < STATS_CALIBRATE_NS) {                                      //too short to time the TSC against
+        usleep((STATS_CALIBRATE_NS - elapsedNs) / 1000);
+        elapsedNs = Stats_Now_Ns() - startNs;
+    }
+    double ticksPerNs = (double)(Stats_Clock() - startTicks) / elapsedNs;
+    const char *clock = "tsc";
+#else
+    double ticksPerNs = 1.0;
+    const char *clock = "monotonic";
+#endif
+    if (ticksPerNs <= 0) {
+        ticksPerNs = 1.0;
+    }
+
+    size_t n = 0;
+    int w = snprintf(out, size, "{\"program\":\"%s\",\"pid\":%ld,\"uptime_s\":%.3f,\"clock\":\"%s\",\"threads\":%u,\"stages\":{",
+                     program, (long)getpid(), elapsedNs / 1e9, clock, used);
+    for (int k = 0; k < STATS_STAGES && w >= 0 && (n += w) < size; k++) {
+        double ns = ticks[k] / ticksPerNs;
+        w = snprintf(out + n, size - n, "%s\"%s\":{\"calls\":%llu,\"ns\":%.0f,\"bytes\":%llu,\"mb_per_s\":%.2f}",
+                     k ? "," : "", stageNames[k], (unsigned long long)calls[k], ns, (unsigned long long)bytes[k],
+                     ns > 0 ? bytes[k] / ns * 1e3 : 0.0);
+    }
+    if (w >= 0 && (n += w) < size) {
+        w = snprintf(out + n, size - n, "},\"counters\":{");
+    }
+    for (int k = 0; k < STATS_COUNTERS && w >= 0 && (n += w) < size; k++) {
+        w = snprintf(out + n, size - n, "%s\"%s\":%llu", k ? "," : "", counterNames[k], (unsigned long long)counters[k]);
+    }
+    if (w >= 0 && (n += w) < size) {
+        w = snprintf(out + n, size - n, "}}");
+    }
+    if (w < 0 || (n += w) >= size) {
+        return 0;
+    }
+    return n;
+}
+
+//One JSON line to `path` ("-" = stdout). Returns 1 on success.
+int Stats_Write(const char *path, const char *program)
+{
+    char json[STATS_JSON_SIZE];
+    size_t len = Stats_Json(json, sizeof(json), program);
+    FILE *file = len == 0 ? NULL : strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (file == NULL) {
+        printf("Error writing stats to %s\n", path);
+        return 0;
+    }
+    fprintf(file, "%s\n", json);
+    return file == stdout ? fflush(stdout) == 0 : fclose(file) == 0;
+}
+
+static void Stats_Exit_Handler(void)
+{
+    Stats_Write(exitPath, exitProgram);
+}
+
+//Writes the stats however the program ends (return from main or exit()), so every mode
+//gets them without its own dump call.
+void Stats_Write_At_Exit(const char *path, const char *program)
+{
+    if (exitPath == NULL) {
+        atexit(Stats_Exit_Handler);
+    }
+    exitPath = path;
+    exitProgram = program;
+}
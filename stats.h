@@ -0,0 +1,95 @@
+//////////////////////
+//   Stage Stats    //
+//////////////////////
+/***********************************************************************
+ *  Toy Steam Cipher Implementation   *
+ ***********************************************************************
+ *Description:  Always-on timing and counters for every step of the exchange.
+ 			Each step records how long it took (time-stamp counter on x86,
+ 			CLOCK_MONOTONIC elsewhere), how often it ran and how many bytes
+ 			it handled; counters track messages, bytes and acks.
+ 			    - every thread adds into a slot of its own: no locks and no
+ 			      atomic read-modify-write on the hot path, one clock read at
+ 			      each end of a step
+ 			    - Stats_Json sums the slots whenever it is asked, so a
+ 			      long-running Bob can be polled (--stats-endpoint) while the
+ 			      steps keep recording
+ 			    - -DTOY_NO_STATS compiles every call down to nothing
+ 			The library (toycipher.c, hex.c) times its own steps; alice.c and
+ 			bob.c time the waits and the ack comparison around them.
+
+ *Use:              uint64_t t = Stats_Clock();
+ *                  ...step...
+ *                  Stats_Stage(STATS_XOR, t, len);
+ *                  Stats_Count(STATS_MESSAGES_SENT, 1);
+ *                  Stats_Write_At_Exit("stats.json", "alice");     // or Stats_Write("-", "alice") now
+_______________________________________________________________________________*/
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define STATS_MAX_THREADS 256           // threads with a slot of their own; any more share one (atomically)
+#define STATS_JSON_SIZE   4096          // enough for every stage and counter
+
+enum stats_stage {
+    STATS_READ,                         // message / seed file read or mapped
+    STATS_KEYGEN,                       // PRNG key and keystream setup
+    STATS_XOR,                          // keystream XOR (encrypt, or decrypt without hashing)
+    STATS_DECRYPT_HASH,                 // Bob's fused decrypt + SHA-256 pass
+    STATS_HEX_DUMP,                     // Key/Ciphertext/Plaintext/Hash dump files
+    STATS_SEND,                         // handing a message to ZeroMQ
+    STATS_RECEIVE,                      // Bob waiting for and receiving ciphertext
+    STATS_ACK_WAIT,                     // Alice waiting for Bob's ack
+    STATS_HASH,                         // SHA-256 on its own
+    STATS_COMPARE,                      // ack memcmp
+    STATS_WRITE,                        // Plaintext.txt / Hash.txt written out
+    STATS_COMPRESS,                     // compress.c: deflate before encryption (plaintext bytes)
+    STATS_DECOMPRESS,                   // compress.c: inflate after decryption (plaintext bytes)
+    STATS_STAGES
+};
+
+enum stats_counter {
+    STATS_MESSAGES_SENT,
+    STATS_BYTES_SENT,
+    STATS_MESSAGES_RECEIVED,
+    STATS_BYTES_RECEIVED,
+    STATS_ACKS_OK,
+    STATS_ACKS_FAILED,
+    STATS_POOL_REUSED,                  // pool.c: buffer handed out again from a free list
+    STATS_POOL_HEAP,                    // pool.c: buffer that had to come from the heap
+    STATS_COMPRESS_BYPASSED,            // compress.c: payload sent raw because it did not shrink
+    STATS_COUNTERS
+};
+
+//Ticks since some fixed point; Stats_Json converts them to nanoseconds.
+static inline uint64_t Stats_Clock(void)
+{
+#if defined(TOY_NO_STATS)
+    return 0;
+#elif defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+#endif
+}
+
+#ifdef TOY_NO_STATS
+#define Stats_Stage(stage, started, bytes) ((void)0)
+#define Stats_Count(counter, n)            ((void)0)
+#else
+void Stats_Stage(int stage, uint64_t started, uint64_t bytes);
+void Stats_Count(int counter, uint64_t n);
+#endif
+size_t Stats_Json(char *out, size_t size, const char *program);
+int Stats_Write(const char *path, const char *program);
+void Stats_Write_At_Exit(const char *path, const char *program);
+
+#endif
@@ -0,0 +1,532 @@
+//////////////////////
+//   libtoycipher   //
+//////////////////////
+/***********************************************************************
+ *  Toy Steam Cipher Implementation   *
+ ***********************************************************************
+ *Description:  Implementation of toycipher.h: the cipher context and the helpers
+ 			alice.c and bob.c used to carry a copy each.
+
+ *Compile:          gcc -O2 -c toycipher.c   (see toycipher.h for the library build)
+_______________________________________________________________________________*/
+
+//Header Files
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <libtomcrypt/tomcrypt.h>
+#include <zmq.h>
+#include "chacha_kernel.h"
+#include "hex.h"
+#include "toycipher.h"
+
+#define TOY_FUSED_BLOCK (64 * 1024)    // decrypt+hash granularity, small enough to stay in L2
+
+
+/*============================
+       Cipher Context
+==============================*/
+//Keys the context from the shared seed (same key bytes as LibTomCrypt's chacha20_prng, see
+//chacha_kernel.c) and starts at keystream byte 0 with an empty hash and no sockets.
+void Toy_Init(toycipher_ctx *ctx, unsigned char *seed, unsigned long seedlen)
+{
+    uint64_t t = Stats_Clock();
+    Chacha_Kernel_Init(&ctx->keystream, seed, seedlen);
+    Stats_Stage(STATS_KEYGEN, t, seedlen);
+    ctx->position = 0;
+    sha256_init(&ctx->md);
+    ctx->zmqContext = NULL;
+    ctx->socket = NULL;
+    ctx->prefetch = NULL;
+}
+
+//Seeking forward just skips keystream; the prefetch ring follows by itself. Seeking back
+//means the ring holds the wrong bytes, so it is restarted at the new position.
+void Toy_Seek(toycipher_ctx *ctx, uint64_t position)
+{
+    if (ctx->prefetch && position < ctx->position) {
+        size_t lookahead = ctx->prefetch->capacity;
+        Keystream_Ring_Stop(ctx->prefetch);
+        if (!Keystream_Ring_Start(ctx->prefetch, &ctx->keystream, position, lookahead)) {
+            free(ctx->prefetch);
+            ctx->prefetch = NULL;
+        }
+    }
+    ctx->position = position;
+}
+
+//Starts a background thread that keeps up to `lookahead` bytes of keystream ready from the
+//current position on (see keystream_ring.h). Only the *_Update calls use it. Returns 1 on success.
+int Toy_Prefetch(toycipher_ctx *ctx, size_t lookahead)
+{
+    if (ctx->prefetch) {
+        return 1;
+    }
+    ctx->prefetch = (keystream_ring*) malloc(sizeof(keystream_ring));
+    if (ctx->prefetch == NULL || !Keystream_Ring_Start(ctx->prefetch, &ctx->keystream, ctx->position, lookahead)) {
+        free(ctx->prefetch);
+        ctx->prefetch = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+//XORs with the keystream at the context's position and moves the position on, without
+//hashing (encryption and decryption are the same XOR). Whatever the prefetch ring has ready
+//is used first; the rest is computed here, split over the kernel's thread pool when large.
+//out may equal in.
+void Toy_Crypt_Update(toycipher_ctx *ctx, unsigned char *out, const unsigned char *in, size_t len)
+{
+    uint64_t t = Stats_Clock();
+    size_t done = 0;
+    if (ctx->prefetch) {
+        done = Keystream_Ring_Xor(ctx->prefetch, ctx->position, out, in, len);
+    }
+    if (done < len) {
+        Chacha_Kernel_Xor_Parallel(&ctx->keystream, ctx->position + done, out + done, in + done, len - done);
+    }
+    ctx->position += len;
+    Stats_Stage(STATS_XOR, t, len);
+}
+
+//Hashes the plaintext, then encrypts it at the context's position. out may equal in.
+void Toy_Encrypt_Update(toycipher_ctx *ctx, unsigned char *out, const unsigned char *in, size_t len)
+{
+    uint64_t t = Stats_Clock();
+    sha256_process(&ctx->md, in, len);
+    Stats_Stage(STATS_HASH, t, len);
+    Toy_Crypt_Update(ctx, out, in, len);
+}
+
+//Decrypts at the context's position and hashes the plaintext in the same pass.
+void Toy_Decrypt_Update(toycipher_ctx *ctx, unsigned char *out, const unsigned char *in, size_t len)
+{
+    if (ctx->prefetch == NULL) {
+        Toy_Decrypt_At(ctx, ctx->position, out, in, len, &ctx->md);
+        ctx->position += len;
+        return;
+    }
+    for (size_t off = 0; off < len; off += TOY_FUSED_BLOCK) {
+        size_t n = len - off < TOY_FUSED_BLOCK ? len - off : TOY_FUSED_BLOCK;
+        Toy_Crypt_Update(ctx, out + off, in + off, n);
+        uint64_t t = Stats_Clock();
+        sha256_process(&ctx->md, out + off, n);
+        Stats_Stage(STATS_HASH, t, n);
+    }
+}
+
+//Hands out the SHA-256 of all plaintext since Toy_Init or the previous Toy_Finish and starts a
+//new one. The keystream position carries on, so the next message never reuses keystream bytes.
+void Toy_Finish(toycipher_ctx *ctx, unsigned char digest[32])
+{
+    sha256_done(&ctx->md, digest);
+    sha256_init(&ctx->md);
+}
+
+//Stateless encryption at an explicit keystream position; ctx is not changed, so any number
+//of threads may call this on one context. out may equal in.
+void Toy_Encrypt_At(const toycipher_ctx *ctx, uint64_t position, unsigned char *out, const unsigned char *in, size_t len)
+{
+    uint64_t t = Stats_Clock();
+    Chacha_Kernel_Xor_Parallel(&ctx->keystream, position, out, in, len);
+    Stats_Stage(STATS_XOR, t, len);
+}
+
+//Stateless decryption at an explicit position. If md is given, the plaintext is fed to it one
+//TOY_FUSED_BLOCK at a time right after that block is XORed, while it is still in cache;
+//SHA-256 is the slow half, so one fused pass beats spreading the XOR over threads and hashing
+//afterwards. Without md the XOR runs on the thread pool. out may equal in.
+void Toy_Decrypt_At(const toycipher_ctx *ctx, uint64_t position, unsigned char *out, const unsigned char *in, size_t len, hash_state *md)
+{
+    uint64_t t = Stats_Clock();
+    if (md == NULL) {
+        Chacha_Kernel_Xor_Parallel(&ctx->keystream, position, out, in, len);
+        Stats_Stage(STATS_XOR, t, len);
+        return;
+    }
+    chacha_kernel_state st = ctx->keystream;
+    Chacha_Kernel_Seek(&st, position);
+    for (size_t off = 0; off < len; off += TOY_FUSED_BLOCK) {
+        size_t n = len - off < TOY_FUSED_BLOCK ? len - off : TOY_FUSED_BLOCK;
+        Chacha_Kernel_Xor(&st, out + off, in + off, n);
+        sha256_process(md, out + off, n);
+    }
+    Stats_Stage(STATS_DECRYPT_HASH, t, len);
+}
+
+//Creates a socket in the context's own ZeroMQ context (made on first use) and remembers it, so
+//a long-lived context keeps its connection between messages. The caller sets options and
+//connects or binds it; Toy_Free closes it.
+void *Toy_Socket(toycipher_ctx *ctx, int type)
+{
+    if (ctx->zmqContext == NULL) {
+        ctx->zmqContext = zmq_ctx_new();
+    }
+    ctx->socket = zmq_socket(ctx->zmqContext, type);
+    return ctx->socket;
+}
+
+void Toy_Free(toycipher_ctx *ctx)
+{
+    if (ctx->prefetch) {
+        Keystream_Ring_Stop(ctx->prefetch);
+        free(ctx->prefetch);
+        ctx->prefetch = NULL;
+    }
+    if (ctx->socket) {
+        zmq_close(ctx->socket);
+        ctx->socket = NULL;
+    }
+    if (ctx->zmqContext) {
+        zmq_ctx_destroy(ctx->zmqContext);
+        ctx->zmqContext = NULL;
+    }
+    memset(&ctx->keystream, 0, sizeof(ctx->keystream));                       //don't leave key material behind
+}
+
+
+/*============================
+        Read from File
+==============================*/
+//Returns a pool buffer (pool.h): release it with Pool_Free.
+unsigned char* Read_File (char fileName[], int *fileLen)
+{
+    uint64_t t = Stats_Clock();
+    FILE *pFile;
+    pFile = fopen(fileName, "r");
+    if (pFile == NULL)
+    {
+	printf("Error opening file.\n");
+	exit(0);
+    }
+    fseek(pFile, 0L, SEEK_END);
+    int temp_size = ftell(pFile)+1;
+    fseek(pFile, 0L, SEEK_SET);
+    unsigned char *output = (unsigned char*) Pool_Alloc(temp_size);
+    fgets(output, temp_size, pFile);
+    fclose(pFile);
+
+    *fileLen = temp_size-1;
+    Stats_Stage(STATS_READ, t, *fileLen);
+    return output;
+}
+
+/*============================
+     Map File (read-only)
+==============================*/
+//Unlike Read_File this maps the file's bytes, newlines and all, straight from the page cache:
+//no heap copy, and files larger than free RAM work because the kernel pages them in and out.
+//The mapping is not NUL-terminated. MADV_SEQUENTIAL lets the kernel read ahead aggressively.
+//If digest is given, the mapping is walked once TOY_HASH_CHUNK at a time and hashed as the
+//pages come in, so the hash is ready when the last byte has been read. Release with Unmap_File.
+unsigned char* Map_File(char fileName[], size_t *fileLen, unsigned char digest[32])
+{
+    static unsigned char empty[1];                                             //mmap cannot map 0 bytes
+    uint64_t t = Stats_Clock();
+    int fd = open(fileName, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        printf("Error opening file %s.\n", fileName);
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+    size_t size = (size_t)st.st_size;
+    unsigned char *data = empty;
+    if (size > 0) {
+        data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            printf("Error mapping file %s.\n", fileName);
+            close(fd);
+            return NULL;
+        }
+        madvise(data, size, MADV_SEQUENTIAL);
+    }
+    close(fd);                                                                 //the mapping keeps the file open
+    Stats_Stage(STATS_READ, t, size);                                          //pages fault in during the hash, if any
+    if (digest) {
+        t = Stats_Clock();
+        hash_state md;
+        sha256_init(&md);
+        for (size_t off = 0; off < size; off += TOY_HASH_CHUNK) {
+            sha256_process(&md, data + off, size - off < TOY_HASH_CHUNK ? size - off : TOY_HASH_CHUNK);
+        }
+        sha256_done(&md, digest);
+        Stats_Stage(STATS_HASH, t, size);
+    }
+    *fileLen = size;
+    return data;
+}
+
+void Unmap_File(unsigned char *data, size_t len)
+{
+    if (len > 0) {
+        munmap(data, len);
+    }
+}
+
+/*============================
+     Map Output File
+==============================*/
+//Creates fileName at exactly `length` bytes and maps it writable, so the plaintext can be
+//decrypted directly into the page cache instead of a heap buffer that is then fwrite()n.
+//Returns NULL (after printing why) if the file cannot be created, sized or mapped.
+unsigned char* Map_Output_File(char fileName[], size_t length)
+{
+    static unsigned char empty[1];                                             //mmap cannot map 0 bytes
+    uint64_t t = Stats_Clock();
+    int fd = open(fileName, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("Error writing %s\n", fileName);
+        return NULL;
+    }
+    if (length == 0) {
+        close(fd);
+        return empty;
+    }
+    if (ftruncate(fd, (off_t)length) != 0) {
+        printf("Error sizing %s to %zu bytes\n", fileName, length);
+        close(fd);
+        return NULL;
+    }
+    unsigned char *data = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);                                                                 //the mapping keeps the file open
+    if (data == MAP_FAILED) {
+        printf("Error mapping %s\n", fileName);
+        return NULL;
+    }
+    madvise(data, length, MADV_SEQUENTIAL);
+    Stats_Stage(STATS_WRITE, t, 0);
+    return data;
+}
+
+//Unmapping hands the dirty pages to the kernel, which writes them back like any other file data.
+void Unmap_Output_File(unsigned char *data, size_t length)
+{
+    uint64_t t = Stats_Clock();
+    if (length > 0) {
+        munmap(data, length);
+    }
+    Stats_Stage(STATS_WRITE, t, length);
+}
+
+/*============================
+        SHA-256 Fucntion
+==============================*/
+//Returns the 32-byte digest in a pool buffer (pool.h): release it with Pool_Free.
+unsigned char* Hash_SHA256(unsigned char* input, unsigned long inputlen)
+{
+    uint64_t t = Stats_Clock();
+    unsigned char *hash_result = (unsigned char*) Pool_Alloc(32);              //a digest is 32 bytes whatever the input
+    //int err;
+    hash_state md;                                                         //LibTomCrypt structure for hash
+    sha256_init(&md);                                                      //Initializing the hash set up
+    sha256_process(&md, (const unsigned char*)input, inputlen);            //Hashing the data given as input with specified length
+    sha256_done(&md, hash_result);                                         //Produces the hash (message digest)
+    Stats_Stage(STATS_HASH, t, inputlen);
+
+    return hash_result;
+}
+
+/*============================
+     Checking an Ack
+==============================*/
+//Step 9 everywhere: does Bob's ack match our SHA-256? Timed and counted in the stats.
+int Toy_Ack_Matches(const unsigned char *ack, size_t acklen, const unsigned char digest[32])
+{
+    uint64_t t = Stats_Clock();
+    int ok = ack != NULL && acklen == 32 && memcmp(ack, digest, 32) == 0;
+    Stats_Stage(STATS_COMPARE, t, 32);
+    Stats_Count(ok ? STATS_ACKS_OK : STATS_ACKS_FAILED, 1);
+    return ok;
+}
+
+/*============================
+        Showing in Hex
+==============================*/
+void Show_in_Hex (char name[], unsigned char hex[], int hexlen)
+{
+    printf("%s: ", name);
+    Hex_Write(stdout, hex, hexlen);
+	printf("\n");
+}
+
+/*============================
+        PRNG Fucntion
+==============================*/
+//Returns a pool buffer (pool.h): release it with Pool_Free.
+unsigned char* PRNG(unsigned char *seed, unsigned long seedlen, unsigned long prnlen)
+{
+    uint64_t t = Stats_Clock();
+    unsigned char *pseudoRandomNumber = (unsigned char*) Pool_Alloc(prnlen);
+
+    chacha_kernel_state keystream;                                             //Same bytes as chacha20_prng_read, see chacha_kernel.c
+    Chacha_Kernel_Init(&keystream, seed, seedlen);
+    Chacha_Kernel_Keystream(&keystream, pseudoRandomNumber, prnlen);           //Writes the result into pseudoRandomNumber[]
+    Stats_Stage(STATS_KEYGEN, t, prnlen);
+
+    return (unsigned char*)pseudoRandomNumber;
+}
+
+/*============================
+        Sending via ZeroMQ
+==============================*/
+//Bounds every send on `socket` by timeoutMs (0 = no limit): frames are only queued once a
+//peer is connected, a send waits at most timeoutMs for one, and closing the socket waits at
+//most timeoutMs for what is still queued. Without it a missing peer blocks the sender in
+//zmq_msg_send or zmq_ctx_destroy for good.
+void Toy_Send_Deadline(void *socket, int timeoutMs)
+{
+    if (timeoutMs <= 0) {
+        return;
+    }
+    int immediate = 1;
+    zmq_setsockopt(socket, ZMQ_IMMEDIATE, &immediate, sizeof(immediate));
+    zmq_setsockopt(socket, ZMQ_SNDTIMEO, &timeoutMs, sizeof(timeoutMs));
+    zmq_setsockopt(socket, ZMQ_LINGER, &timeoutMs, sizeof(timeoutMs));
+}
+
+//One-shot REQ send to `endpoint` (Alice -> Bob's data endpoint, Bob -> Alice's ack endpoint).
+//send[] is handed to ZeroMQ with zmq_msg_init_data, so it goes on the wire without being copied.
+//zmq_ctx_destroy only returns once the message has been sent (or timeoutMs has passed, see
+//Toy_Send_Deadline), so send[] is the caller's again after. Returns 0 if no peer took it.
+int Send_via_ZMQ(const char *endpoint, unsigned char send[], size_t sendlen, int timeoutMs)
+{
+    uint64_t t = Stats_Clock();
+    void *context = zmq_ctx_new ();					        //creates a socket to talk to the other side
+    void *requester = zmq_socket (context, ZMQ_REQ);		    		//creates requester that sends the messages
+    Toy_Send_Deadline(requester, timeoutMs);
+    printf("Connecting to %s and sending the message...\n", endpoint);
+    zmq_connect (requester, endpoint);		    		                //make outgoing connection from socket
+    zmq_msg_t msg;
+    zmq_msg_init_data (&msg, send, sendlen, NULL, NULL);                       //no free function: send[] is not ours to free
+    int sent = zmq_msg_send (&msg, requester, 0) >= 0;			    	//send msg
+    if (!sent) {
+        printf("Nobody took the message on %s within %d ms\n", endpoint, timeoutMs);
+        zmq_msg_close (&msg);
+    }
+    zmq_close (requester);						        //closes the requester socket
+    zmq_ctx_destroy (context);					                //destroys the context & terminates all 0MQ processes
+    Stats_Stage(STATS_SEND, t, sendlen);
+    Stats_Count(STATS_MESSAGES_SENT, sent);
+    Stats_Count(STATS_BYTES_SENT, sent ? sendlen : 0);
+    return sent;
+}
+
+/*============================
+     Pooled ZeroMQ Message
+==============================*/
+//Like zmq_msg_init_size, but the payload is a pool buffer that goes back to the pool once
+//ZeroMQ has sent the message (or it is closed), so steady-state sends reuse the same buffers.
+//Returns 0 on success, -1 if no buffer could be had.
+int Toy_Msg_Init(zmq_msg_t *msg, size_t len)
+{
+    void *buffer = Pool_Alloc(len);
+    if (buffer == NULL) {
+        return -1;
+    }
+    return zmq_msg_init_data(msg, buffer, len, Pool_Free_Msg, NULL);
+}
+
+/*============================
+        Receiving via ZeroMQ
+==============================*/
+//Receives one message of any size into msg. No copy is made: the returned pointer is ZeroMQ's
+//own buffer and stays valid until zmq_msg_close(msg). Returns NULL on error.
+unsigned char *Receive_via_ZMQ(void *socket, zmq_msg_t *msg, size_t *receivelen)
+{
+    zmq_msg_init (msg);
+    if (zmq_msg_recv (msg, socket, 0) < 0) {                                   //ZeroMQ sizes the buffer to whatever arrives
+        printf("Receive error: %s\n", zmq_strerror(zmq_errno()));
+        zmq_msg_close (msg);
+        return NULL;
+    }
+    *receivelen = zmq_msg_size (msg);
+    return (unsigned char*) zmq_msg_data (msg);
+}
+
+/*============================
+     Batch Manifest / Dir
+==============================*/
+static int Toy_Batch_Compare(const void *a, const void *b)
+{
+    return strcmp(((const toy_batch_pair*)a)->message, ((const toy_batch_pair*)b)->message);
+}
+
+static int Toy_Batch_Add(toy_batch_pair **pairs, size_t *count, size_t *room, const char *message, const char *seed)
+{
+    if (strlen(message) >= TOY_BATCH_PATH || strlen(seed) >= TOY_BATCH_PATH) {
+        printf("Path too long in batch: %s\n", message);
+        return 0;
+    }
+    if (access(message, R_OK) != 0 || access(seed, R_OK) != 0) {               //Read_File would exit on a missing seed
+        printf("Batch pair %s %s: file not readable\n", message, seed);
+        return 0;
+    }
+    if (*count == *room) {
+        *room = *room ? *room * 2 : 64;
+        *pairs = (toy_batch_pair*) realloc(*pairs, *room * sizeof(toy_batch_pair));
+    }
+    strcpy((*pairs)[*count].message, message);
+    strcpy((*pairs)[*count].seed, seed);
+    (*count)++;
+    return 1;
+}
+
+//Builds the list of message/seed pairs for --batch. path is either
+//  - a manifest: one "MessageFile SeedFile" pair per line, '#' starts a comment, or
+//  - a directory: every MessageX.txt in it paired with SharedSeedX.txt, sorted by name.
+//Alice and Bob load the same path, so a pair's index in the list is its seed id on the wire.
+//Returns the number of pairs (0 after printing why if there are none or one is unusable).
+size_t Toy_Batch_Load(const char *path, toy_batch_pair **pairs)
+{
+    size_t count = 0, room = 0;
+    int ok = 1;
+    struct stat st;
+    *pairs = NULL;
+    if (stat(path, &st) != 0) {
+        printf("Cannot open batch %s\n", path);
+        return 0;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        DIR *dir = opendir(path);
+        struct dirent *entry;
+        while (ok && dir && (entry = readdir(dir)) != NULL) {
+            size_t n = strlen(entry->d_name);
+            if (strncmp(entry->d_name, "Message", 7) != 0 || n < 11 || strcmp(entry->d_name + n - 4, ".txt") != 0) {
+                continue;
+            }
+            char message[TOY_BATCH_PATH * 2], seed[TOY_BATCH_PATH * 2];
+            snprintf(message, sizeof(message), "%s/%s", path, entry->d_name);
+            snprintf(seed, sizeof(seed), "%s/SharedSeed%s", path, entry->d_name + 7);   //MessageX.txt -> SharedSeedX.txt
+            ok = Toy_Batch_Add(pairs, &count, &room, message, seed);
+        }
+        if (dir) closedir(dir);
+        if (ok && count > 0) {
+            qsort(*pairs, count, sizeof(toy_batch_pair), Toy_Batch_Compare);   //readdir order is arbitrary
+        }
+    } else {
+        FILE *manifest = fopen(path, "r");
+        char line[TOY_BATCH_PATH * 2 + 8], message[TOY_BATCH_PATH * 2], seed[TOY_BATCH_PATH * 2];
+        while (ok && manifest && fgets(line, sizeof(line), manifest)) {
+            char *hash = strchr(line, '#');
+            if (hash) *hash = '\0';
+            if (sscanf(line, "%1023s %1023s", message, seed) != 2) {
+                continue;                                                      //blank or comment line
+            }
+            ok = Toy_Batch_Add(pairs, &count, &room, message, seed);
+        }
+        if (manifest) fclose(manifest);
+    }
+    if (!ok || count == 0) {
+        if (ok) printf("No message/seed pairs in %s\n", path);
+        free(*pairs);
+        *pairs = NULL;
+        return 0;
+    }
+    return count;
+}
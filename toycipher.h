@@ -0,0 +1,99 @@
+//////////////////////
+//   libtoycipher   //
+//////////////////////
+/***********************************************************************
+ *  Toy Steam Cipher Implementation   *
+ ***********************************************************************
+ *Description:  The cipher, hashing, file and ZeroMQ helpers shared by alice.c and
+ 			bob.c, as a library other programs can link and call in-process.
+
+ 			A toycipher_ctx is keyed once from the shared seed and then
+ 			reused for any number of messages: no process start-up and no
+ 			re-initialisation per message. It holds
+ 			    - the keyed ChaCha20 state (chacha_kernel.c),
+ 			    - the keystream position the next *_Update call uses,
+ 			    - a running SHA-256 of the plaintext seen by *_Update,
+ 			    - a ZeroMQ context and socket (Toy_Socket), closed by Toy_Free,
+ 			    - optionally a keystream ring (Toy_Prefetch) whose thread keeps
+ 			      keystream ready ahead of the position, so *_Update calls on
+ 			      small messages are a buffer read plus XOR.
+ 			Every call records its time and bytes per step in stats.c.
+ 			Read_File, PRNG, Hash_SHA256 and Toy_Msg_Init hand out pool
+ 			buffers (pool.c); release them with Pool_Free, or let ZeroMQ do
+ 			it for a sent message.
+ 			Session payloads may be deflated before encryption (compress.c).
+ 			Artifact files can be queued to a background writer (writer.c).
+ 			The *_At calls take an explicit keystream position and leave the
+ 			context untouched, so several threads can share one context.
+
+ *Use:              toycipher_ctx ctx;
+ *                  Toy_Init(&ctx, seed, seedlen);
+ *                  Toy_Encrypt_Update(&ctx, cipher, message, len);   // as often as needed
+ *                  Toy_Finish(&ctx, digest);                          // SHA-256 of the plaintext, ready for the next message
+ *                  Toy_Free(&ctx);
+
+ *Build:            gcc -O2 -c toycipher.c chacha_kernel.c keystream_ring.c merkle.c hex.c stats.c pool.c compress.c writer.c
+ *                  ar rcs libtoycipher.a toycipher.o chacha_kernel.o keystream_ring.o merkle.o hex.o stats.o pool.o compress.o writer.o
+ *                  gcc app.c -L. -ltoycipher -ltomcrypt -lzmq -lz -lpthread -o app
+_______________________________________________________________________________*/
+#ifndef TOYCIPHER_H
+#define TOYCIPHER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <libtomcrypt/tomcrypt.h>
+#include <zmq.h>
+#include "chacha_kernel.h"
+#include "keystream_ring.h"
+#include "stats.h"
+#include "pool.h"
+#include "compress.h"
+#include "writer.h"
+
+#define TOY_HASH_CHUNK (64 * 1024)     // hashing granularity when walking a mapped file
+#define TOY_BATCH_PATH 512             // longest message/seed path in a batch manifest
+
+typedef struct {
+    chacha_kernel_state keystream;     // keyed from the seed, never advanced itself
+    uint64_t position;                 // keystream byte the next *_Update call starts at
+    hash_state md;                     // SHA-256 of the plaintext since Toy_Init / the last Toy_Finish
+    void *zmqContext;                  // created by the first Toy_Socket
+    void *socket;                      // the last socket Toy_Socket made, closed by Toy_Free
+    keystream_ring *prefetch;          // Toy_Prefetch, NULL when off
+} toycipher_ctx;
+
+typedef struct {
+    char message[TOY_BATCH_PATH];
+    char seed[TOY_BATCH_PATH];
+} toy_batch_pair;
+
+//Cipher context
+void Toy_Init(toycipher_ctx *ctx, unsigned char *seed, unsigned long seedlen);
+void Toy_Seek(toycipher_ctx *ctx, uint64_t position);
+int Toy_Prefetch(toycipher_ctx *ctx, size_t lookahead);
+void Toy_Crypt_Update(toycipher_ctx *ctx, unsigned char *out, const unsigned char *in, size_t len);
+void Toy_Encrypt_Update(toycipher_ctx *ctx, unsigned char *out, const unsigned char *in, size_t len);
+void Toy_Decrypt_Update(toycipher_ctx *ctx, unsigned char *out, const unsigned char *in, size_t len);
+void Toy_Finish(toycipher_ctx *ctx, unsigned char digest[32]);
+void Toy_Encrypt_At(const toycipher_ctx *ctx, uint64_t position, unsigned char *out, const unsigned char *in, size_t len);
+void Toy_Decrypt_At(const toycipher_ctx *ctx, uint64_t position, unsigned char *out, const unsigned char *in, size_t len, hash_state *md);
+void *Toy_Socket(toycipher_ctx *ctx, int type);
+void Toy_Free(toycipher_ctx *ctx);
+
+//Shared helpers (formerly copied into both alice.c and bob.c)
+unsigned char* Read_File (char fileName[], int *fileLen);
+unsigned char* PRNG(unsigned char *seed, unsigned long seedlen, unsigned long prnlen);
+unsigned char* Hash_SHA256(unsigned char input[], unsigned long inputlen);
+int Toy_Ack_Matches(const unsigned char *ack, size_t acklen, const unsigned char digest[32]);
+void Show_in_Hex (char name[], unsigned char hex[], int hexlen);
+void Toy_Send_Deadline(void *socket, int timeoutMs);
+int Send_via_ZMQ(const char *endpoint, unsigned char send[], size_t sendlen, int timeoutMs);
+int Toy_Msg_Init(zmq_msg_t *msg, size_t len);
+unsigned char *Receive_via_ZMQ(void *socket, zmq_msg_t *msg, size_t *receivelen);
+unsigned char* Map_File(char fileName[], size_t *fileLen, unsigned char digest[32]);
+void Unmap_File(unsigned char *data, size_t len);
+unsigned char* Map_Output_File(char fileName[], size_t length);
+void Unmap_Output_File(unsigned char *data, size_t length);
+size_t Toy_Batch_Load(const char *path, toy_batch_pair **pairs);
+
+#endif
@@ -0,0 +1,631 @@
+//////////////////////
+//   Async Writer   //
+//////////////////////
+/***********************************************************************
+ *  Toy Steam Cipher Implementation   *
+ ***********************************************************************
+ *Description:  Queued artifact writes (writer.h).
+ 			1. Writer_Append splits its data into WRITER_BLOCK pieces, each
+ 			   a job with its own file offset, so pieces may be written in
+ 			   any order and by any thread.
+ 			2. A file's close is a job too. Whoever finishes the file's last
+ 			   piece after the close was asked for closes it (fdatasync first
+ 			   when durable), so a close never waits in the caller.
+ 			3. `outstanding` counts queued and running jobs; Writer_Finish
+ 			   sleeps until it is 0.
+ 			4. io_uring: one thread moves jobs from the queue into the
+ 			   submission ring, up to WRITER_DEPTH in flight, and finishes
+ 			   them from the completion ring (short writes are resubmitted).
+ 			   The ring is set up with the raw syscalls; if the kernel or a
+ 			   seccomp filter refuses, the thread pool is used instead.
+
+ *Compile:          gcc -c writer.c     (part of libtoycipher, see toycipher.h)
+_______________________________________________________________________________*/
+
+//Header Files
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "writer.h"
+#include "hex.h"
+#include "pool.h"
+#include "stats.h"
+#if defined(__linux__) && defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#include <linux/io_uring.h>
+#define WRITER_HAVE_URING 1
+#endif
+
+typedef struct {
+    int used;
+    int fd;
+    int closeQueued;                    // Writer_Close called (or queued by Writer_Finish)
+    int closing;                        // close job ran while pieces were still pending
+    size_t pending;                     // pieces queued or in flight
+    off_t end;                          // where the next Writer_Append lands
+    char name[256];
+} writer_file;
+
+typedef struct {
+    const unsigned char *data;
+    size_t pieces;                      // not written yet; release runs when this reaches 0
+    writer_release_fn release;
+    void *hint;
+} writer_data;
+
+typedef struct writer_job {
+    struct writer_job *next;
+    int close;                          // 1 = close `file` once its pieces are done
+    int file;
+    int hex;
+    writer_data *owner;
+    const unsigned char *in;            // this piece of owner->data
+    size_t len;                         // input bytes
+    off_t offset;                       // file offset of the output
+    unsigned char *text;                // hex output (pool buffer), NULL for raw
+    size_t done;                        // output bytes written so far
+    uint64_t started;
+} writer_job;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work;                // jobs queued
+    pthread_cond_t idle;                // outstanding reached 0
+    writer_job *head, *tail;
+    size_t outstanding;
+    int backend;                        // enum writer_backend, WRITER_SYNC until Writer_Start
+    int durable;
+    int failed;
+    int exitRegistered;
+    writer_file files[WRITER_MAX_FILES];
+    char tracked[WRITER_MAX_SYNCS][256];
+    int trackedCount;
+} writer = { .lock = PTHREAD_MUTEX_INITIALIZER, .work = PTHREAD_COND_INITIALIZER, .idle = PTHREAD_COND_INITIALIZER,
+              .backend = WRITER_SYNC };
+
+static void Writer_Run(writer_job *job);
+
+/*============================
+        Jobs (any backend)
+==============================*/
+//Hex pieces are encoded here, on the thread that writes them, not in the caller.
+static const unsigned char *Writer_Output(writer_job *job, size_t *outlen)
+{
+    if (job->hex && job->text == NULL) {
+        uint64_t t = Stats_Clock();
+        job->text = Pool_Alloc(2 * job->len);
+        if (job->text == NULL) {
+            *outlen = 0;
+            return NULL;
+        }
+        Hex_Encode((char*) job->text, job->in, job->len);
+        Stats_Stage(STATS_HEX_DUMP, t, job->len);
+    }
+    *outlen = job->hex ? 2 * job->len : job->len;
+    return job->hex ? job->text : job->in;
+}
+
+static void Writer_Retire(void)
+{
+    pthread_mutex_lock(&writer.lock);
+    if (--writer.outstanding == 0) {
+        pthread_cond_broadcast(&writer.idle);
+    }
+    pthread_mutex_unlock(&writer.lock);
+}
+
+static void Writer_Close_File(int file)
+{
+    writer_file *f = &writer.files[file];
+    int ok = 1;
+    if (writer.durable) {
+        uint64_t t = Stats_Clock();
+        ok = fdatasync(f->fd) == 0;
+        Stats_Stage(STATS_WRITE, t, 0);
+    }
+    ok = close(f->fd) == 0 && ok;
+    if (!ok) {
+        printf("Error finishing %s: %s\n", f->name, strerror(errno));
+    }
+    pthread_mutex_lock(&writer.lock);
+    writer.failed |= !ok;
+    f->used = 0;
+    pthread_mutex_unlock(&writer.lock);
+}
+
+static void Writer_Close_Job(writer_job *job)
+{
+    pthread_mutex_lock(&writer.lock);
+    writer_file *f = &writer.files[job->file];
+    int closeNow = f->pending == 0;
+    f->closing = !closeNow;                                                    //else the last piece closes it
+    pthread_mutex_unlock(&writer.lock);
+    if (closeNow) {
+        Writer_Close_File(job->file);
+    }
+    Pool_Free(job);
+    Writer_Retire();
+}
+
+//`count` pieces of owner in `file` are finished (written, or failed with error code `error`):
+//the last one releases the data and, if Writer_Close already ran, closes the file.
+static void Writer_Settle(writer_data *owner, int file, size_t count, int error)
+{
+    pthread_mutex_lock(&writer.lock);
+    writer_file *f = &writer.files[file];
+    writer.failed |= error != 0;
+    f->pending -= count;
+    owner->pieces -= count;
+    int closeNow = f->pending == 0 && f->closing;
+    int release = owner->pieces == 0;
+    pthread_mutex_unlock(&writer.lock);
+    if (error) {
+        printf("Error writing %s: %s\n", f->name, strerror(error));
+    }
+    if (release) {
+        if (owner->release) {
+            owner->release((void*) owner->data, owner->hint);
+        }
+        Pool_Free(owner);
+    }
+    if (closeNow) {
+        Writer_Close_File(file);
+    }
+}
+
+//A piece is finished (written, or failed with error code `error`).
+static void Writer_Done(writer_job *job, int error)
+{
+    Pool_Free(job->text);
+    Writer_Settle(job->owner, job->file, 1, error);
+    Pool_Free(job);
+    Writer_Retire();
+}
+
+//Blocking write of one piece: the thread pool and WRITER_SYNC.
+static void Writer_Run(writer_job *job)
+{
+    if (job->close) {
+        Writer_Close_Job(job);
+        return;
+    }
+    size_t outlen;
+    const unsigned char *out = Writer_Output(job, &outlen);
+    int fd = writer.files[job->file].fd;
+    int error = out == NULL ? ENOMEM : 0;
+    uint64_t t = Stats_Clock();
+    while (!error && job->done < outlen) {
+        ssize_t n = pwrite(fd, out + job->done, outlen - job->done, job->offset + (off_t)job->done);
+        if (n < 0 && errno != EINTR) {
+            error = errno;
+        } else if (n == 0) {
+            error = EIO;
+        } else if (n > 0) {
+            job->done += (size_t)n;
+        }
+    }
+    Stats_Stage(STATS_WRITE, t, job->done);
+    Writer_Done(job, error);
+}
+
+static void Writer_Queue(writer_job *job)
+{
+    pthread_mutex_lock(&writer.lock);
+    writer.outstanding++;
+    if (writer.backend == WRITER_SYNC) {
+        pthread_mutex_unlock(&writer.lock);
+        Writer_Run(job);
+        return;
+    }
+    job->next = NULL;
+    if (writer.tail) writer.tail->next = job; else writer.head = job;
+    writer.tail = job;
+    pthread_cond_signal(&writer.work);
+    pthread_mutex_unlock(&writer.lock);
+}
+
+//Takes the oldest queued job; the caller holds the lock.
+static writer_job *Writer_Take(void)
+{
+    writer_job *job = writer.head;
+    if (job) {
+        writer.head = job->next;
+        if (writer.head == NULL) {
+            writer.tail = NULL;
+        }
+    }
+    return job;
+}
+
+/*============================
+         Thread Pool
+==============================*/
+static void *Writer_Pool_Thread(void *arg)
+{
+    (void)arg;
+    for (;;) {
+        pthread_mutex_lock(&writer.lock);
+        while (writer.head == NULL) {
+            pthread_cond_wait(&writer.work, &writer.lock);
+        }
+        writer_job *job = Writer_Take();
+        pthread_mutex_unlock(&writer.lock);
+        Writer_Run(job);
+    }
+    return NULL;
+}
+
+/*============================
+           io_uring
+==============================*/
+#ifdef WRITER_HAVE_URING
+static struct {
+    int fd;
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+} ring;
+
+//Maps the submission/completion rings. Returns 0 (nothing left open) if io_uring is unusable.
+static int Writer_Ring_Setup(void)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = (int) syscall(__NR_io_uring_setup, WRITER_DEPTH, &p);
+    if (fd < 0) {
+        return 0;
+    }
+    if (!(p.features & IORING_FEAT_RW_CUR_POS)) {                              //no IORING_OP_WRITE before this kernel (5.6)
+        close(fd);
+        return 0;
+    }
+    size_t sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cqSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    int single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && cqSize > sqSize) {
+        sqSize = cqSize;
+    }
+    unsigned char *sq = mmap(NULL, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    unsigned char *cq = single ? sq : mmap(NULL, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    void *sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) {
+        close(fd);                                                             //the mappings go with the process
+        return 0;
+    }
+    ring.fd = fd;
+    ring.sqHead = (unsigned*)(sq + p.sq_off.head);
+    ring.sqTail = (unsigned*)(sq + p.sq_off.tail);
+    ring.sqMask = (unsigned*)(sq + p.sq_off.ring_mask);
+    ring.sqArray = (unsigned*)(sq + p.sq_off.array);
+    ring.cqHead = (unsigned*)(cq + p.cq_off.head);
+    ring.cqTail = (unsigned*)(cq + p.cq_off.tail);
+    ring.cqMask = (unsigned*)(cq + p.cq_off.ring_mask);
+    ring.sqes = (struct io_uring_sqe*) sqes;
+    ring.cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    return 1;
+}
+
+//Puts the rest of a piece in the submission ring. Only the writer thread touches the SQ tail.
+static void Writer_Ring_Push(writer_job *job, const unsigned char *out, size_t outlen)
+{
+    unsigned tail = *ring.sqTail;
+    unsigned index = tail & *ring.sqMask;
+    struct io_uring_sqe *sqe = &ring.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = writer.files[job->file].fd;
+    sqe->addr = (unsigned long long)(uintptr_t)(out + job->done);
+    sqe->len = (unsigned)(outlen - job->done);
+    sqe->off = (unsigned long long)(job->offset + (off_t)job->done);
+    sqe->user_data = (unsigned long long)(uintptr_t) job;
+    ring.sqArray[index] = index;
+    __atomic_store_n(ring.sqTail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static void *Writer_Ring_Thread(void *arg)
+{
+    (void)arg;
+    unsigned inflight = 0, unsubmitted = 0;
+    for (;;) {
+//------Move queued jobs into the ring, as many as there is room for.
+        writer_job *taken = NULL, **last = &taken;
+        unsigned room = WRITER_DEPTH - inflight - unsubmitted;
+        pthread_mutex_lock(&writer.lock);
+        while (writer.head == NULL && inflight == 0 && unsubmitted == 0) {
+            pthread_cond_wait(&writer.work, &writer.lock);
+        }
+        for (writer_job *job; room > 0 && (job = Writer_Take()) != NULL; room--) {
+            *last = job;
+            last = &job->next;
+        }
+        *last = NULL;
+        pthread_mutex_unlock(&writer.lock);
+        int tookAny = taken != NULL;
+        while (taken) {
+            writer_job *job = taken;
+            taken = job->next;
+            if (job->close) {
+                Writer_Close_Job(job);
+                continue;
+            }
+            size_t outlen;
+            const unsigned char *out = Writer_Output(job, &outlen);
+            if (out == NULL) {
+                Writer_Done(job, ENOMEM);
+                continue;
+            }
+            job->started = Stats_Clock();
+            Writer_Ring_Push(job, out, outlen);
+            unsubmitted++;
+        }
+
+//------Submit; wait for a completion only when there was nothing new to do.
+        if (unsubmitted > 0 || (!tookAny && inflight > 0)) {
+            int wait = !tookAny && unsubmitted == 0;
+            long n = syscall(__NR_io_uring_enter, ring.fd, unsubmitted, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+            if (n > 0) {
+                unsubmitted -= (unsigned) n;
+                inflight += (unsigned) n;
+            } else if (n < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                printf("io_uring_enter failed: %s\n", strerror(errno));
+            }
+        }
+
+//------Finish whatever has completed.
+        unsigned head = *ring.cqHead;
+        unsigned tail = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cqMask];
+            writer_job *job = (writer_job*)(uintptr_t) cqe->user_data;
+            int res = cqe->res;
+            inflight--;
+            size_t outlen;
+            const unsigned char *out = Writer_Output(job, &outlen);
+            if (res < 0) {
+                Writer_Done(job, -res);
+            } else if (res == 0) {
+                Writer_Done(job, EIO);
+            } else if ((job->done += (size_t) res) < outlen) {
+                Writer_Ring_Push(job, out, outlen);                            //short write: the rest goes again
+                unsubmitted++;
+            } else {
+                Stats_Stage(STATS_WRITE, job->started, outlen);
+                Writer_Done(job, 0);
+            }
+        }
+        __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+#endif
+
+/*============================
+          Start / Stop
+==============================*/
+static void Writer_Exit(void)
+{
+    Writer_Finish();
+}
+
+//Starts the background writer. `backend` is enum writer_backend: WRITER_AUTO tries io_uring,
+//then the thread pool. With `durable` every file is fdatasync()ed before it is closed, and
+//Writer_Track'ed files at Writer_Finish. Returns the backend in use. Call once, before any write.
+int Writer_Start(int backend, int durable)
+{
+    writer.durable = durable;
+    if (!writer.exitRegistered) {
+        atexit(Writer_Exit);                                                   //no artifact is lost to an early return
+        writer.exitRegistered = 1;
+    }
+    if (backend == WRITER_SYNC) {
+        return writer.backend = WRITER_SYNC;
+    }
+    pthread_t thread;
+#ifdef WRITER_HAVE_URING
+    if (backend != WRITER_POOL && Writer_Ring_Setup()) {
+        if (pthread_create(&thread, NULL, Writer_Ring_Thread, NULL) == 0) {
+            pthread_detach(thread);
+            return writer.backend = WRITER_IO_URING;
+        }
+        close(ring.fd);
+    }
+#endif
+    if (backend == WRITER_IO_URING) {
+        printf("io_uring is not available, writing with %d threads\n", WRITER_THREADS);
+    }
+    int threads = 0;
+    for (int i = 0; i < WRITER_THREADS; i++) {
+        if (pthread_create(&thread, NULL, Writer_Pool_Thread, NULL) == 0) {
+            pthread_detach(thread);
+            threads++;
+        }
+    }
+    return writer.backend = threads > 0 ? WRITER_POOL : WRITER_SYNC;
+}
+
+const char *Writer_Backend_Name(void)
+{
+    return writer.backend == WRITER_IO_URING ? "io_uring" : writer.backend == WRITER_POOL ? "threads" : "sync";
+}
+
+//"auto", "uring", "threads" or "sync" (the --writer option); -1 for anything else.
+int Writer_Parse_Backend(const char *name)
+{
+    if (strcmp(name, "auto") == 0) return WRITER_AUTO;
+    if (strcmp(name, "uring") == 0 || strcmp(name, "io_uring") == 0) return WRITER_IO_URING;
+    if (strcmp(name, "threads") == 0) return WRITER_POOL;
+    if (strcmp(name, "sync") == 0) return WRITER_SYNC;
+    return -1;
+}
+
+/*============================
+           Files
+==============================*/
+//Creates (or truncates) fileName for queued writes. Returns its handle, or -1 after printing why.
+int Writer_Open(const char *fileName)
+{
+    int fd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("Error opening %s for writing\n", fileName);
+        return -1;
+    }
+    pthread_mutex_lock(&writer.lock);
+    int file = 0;
+    while (file < WRITER_MAX_FILES && writer.files[file].used) {
+        file++;
+    }
+    if (file < WRITER_MAX_FILES) {
+        writer_file *f = &writer.files[file];
+        memset(f, 0, sizeof(*f));
+        f->used = 1;
+        f->fd = fd;
+        snprintf(f->name, sizeof(f->name), "%s", fileName);
+    }
+    pthread_mutex_unlock(&writer.lock);
+    if (file == WRITER_MAX_FILES) {
+        printf("Too many files open for writing, not writing %s\n", fileName);
+        close(fd);
+        return -1;
+    }
+    return file;
+}
+
+//name.txt or name.bin for the dump mode, like Dump_Open; -1 for DUMP_NONE or on error.
+int Writer_Open_Dump(const char *name, int mode)
+{
+    char fileName[256];
+    if (mode == DUMP_NONE) {
+        return -1;
+    }
+    snprintf(fileName, sizeof(fileName), "%s%s", name, DUMP_EXTENSION(mode));
+    return Writer_Open(fileName);
+}
+
+//Queues data[len] at the end of `file` (hex-encoded if `hex`) and returns at once. data must
+//stay valid until release(data, hint) runs, which happens exactly once: after the last piece
+//is written, or right away if file is -1. With no release, keep it until Writer_Finish.
+void Writer_Append(int file, const unsigned char *data, size_t len, int hex, writer_release_fn release, void *hint)
+{
+    size_t pieces = (len + WRITER_BLOCK - 1) / WRITER_BLOCK;
+    writer_data *owner = file < 0 || pieces == 0 ? NULL : Pool_Alloc(sizeof(writer_data));
+    if (owner == NULL) {
+        if (release) {
+            release((void*) data, hint);
+        }
+        return;
+    }
+    owner->data = data;
+    owner->pieces = pieces;
+    owner->release = release;
+    owner->hint = hint;
+    pthread_mutex_lock(&writer.lock);
+    writer_file *f = &writer.files[file];
+    off_t offset = f->end;
+    f->end += (off_t)(hex ? 2 * len : len);
+    f->pending += pieces;
+    pthread_mutex_unlock(&writer.lock);
+    for (size_t at = 0; at < len; at += WRITER_BLOCK) {
+        writer_job *job = Pool_Alloc(sizeof(writer_job));
+        if (job == NULL) {                                                     //the pieces not queued count as failed
+            Writer_Settle(owner, file, (len - at + WRITER_BLOCK - 1) / WRITER_BLOCK, ENOMEM);
+            return;
+        }
+        memset(job, 0, sizeof(*job));
+        job->file = file;
+        job->hex = hex;
+        job->owner = owner;
+        job->in = data + at;
+        job->len = len - at < WRITER_BLOCK ? len - at : WRITER_BLOCK;
+        job->offset = offset + (off_t)(hex ? 2 * at : at);
+        Writer_Queue(job);
+    }
+}
+
+//Closes `file` once everything queued for it is written; returns at once.
+void Writer_Close(int file)
+{
+    if (file < 0) {
+        return;
+    }
+    pthread_mutex_lock(&writer.lock);
+    int queued = writer.files[file].closeQueued;
+    writer.files[file].closeQueued = 1;
+    pthread_mutex_unlock(&writer.lock);
+    if (queued) {
+        return;
+    }
+    writer_job *job = Pool_Alloc(sizeof(writer_job));
+    if (job == NULL) {                                                         //no job: let the last piece close it
+        pthread_mutex_lock(&writer.lock);
+        writer.failed = 1;
+        int closeNow = writer.files[file].pending == 0;
+        writer.files[file].closing = !closeNow;
+        pthread_mutex_unlock(&writer.lock);
+        if (closeNow) {
+            Writer_Close_File(file);
+        }
+        return;
+    }
+    memset(job, 0, sizeof(*job));
+    job->close = 1;
+    job->file = file;
+    Writer_Queue(job);
+}
+
+//Whole dump in one call, the queued Dump_File. Returns 1 when queued (or skipped with
+//DUMP_NONE), 0 if the file could not be created; release runs either way.
+int Writer_Dump(const char *name, const unsigned char *data, size_t len, int mode, writer_release_fn release, void *hint)
+{
+    int file = Writer_Open_Dump(name, mode);
+    Writer_Append(file, data, len, mode == DUMP_HEX, release, hint);
+    Writer_Close(file);
+    return file >= 0 || mode == DUMP_NONE;
+}
+
+//A file written some other way (e.g. through a mapping) that --durable should also flush.
+void Writer_Track(const char *fileName)
+{
+    pthread_mutex_lock(&writer.lock);
+    if (writer.trackedCount < WRITER_MAX_SYNCS) {
+        snprintf(writer.tracked[writer.trackedCount++], sizeof(writer.tracked[0]), "%s", fileName);
+    }
+    pthread_mutex_unlock(&writer.lock);
+}
+
+//Closes every file still open, waits until all queued writes are done and, when durable,
+//flushes the tracked files. Returns 1 if every write succeeded.
+int Writer_Finish(void)
+{
+    for (int file = 0; file < WRITER_MAX_FILES; file++) {
+        pthread_mutex_lock(&writer.lock);
+        int open = writer.files[file].used && !writer.files[file].closeQueued;
+        pthread_mutex_unlock(&writer.lock);
+        if (open) {
+            Writer_Close(file);
+        }
+    }
+    pthread_mutex_lock(&writer.lock);
+    while (writer.outstanding > 0) {
+        pthread_cond_wait(&writer.idle, &writer.lock);
+    }
+    int count = writer.durable ? writer.trackedCount : 0;
+    writer.trackedCount = 0;
+    pthread_mutex_unlock(&writer.lock);
+    for (int i = 0; i < count; i++) {
+        int fd = open(writer.tracked[i], O_WRONLY);
+        if (fd < 0 || fdatasync(fd) != 0) {
+            printf("Error flushing %s\n", writer.tracked[i]);
+            writer.failed = 1;
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    return !writer.failed;
+}
@@ -0,0 +1,59 @@
+//////////////////////
+//   Async Writer   //
+//////////////////////
+/***********************************************************************
+ *  Toy Steam Cipher Implementation   *
+ ***********************************************************************
+ *Description:  Background writer for the artifact files (Key/Ciphertext/Hash dumps,
+ 			Bob's session Plaintext.txt), so a dump is queued and the send
+ 			or ack goes out at once instead of waiting for the disk.
+ 			    - io_uring when the kernel allows it (raw syscalls, no
+ 			      liburing): one thread keeps up to WRITER_DEPTH writes in
+ 			      flight
+ 			    - otherwise WRITER_THREADS threads doing pwrite()
+ 			    - WRITER_SYNC writes in the calling thread, as before
+ 			    - writes are split into WRITER_BLOCK pieces at their own file
+ 			      offsets; hex dumps are encoded on the writer's thread(s)
+ 			    - durable: every file is fdatasync()ed before it is closed
+ 			Writer_Finish waits for everything queued and runs at exit as
+ 			well, so no artifact is ever lost to an early return.
+
+ *Use:              Writer_Start(WRITER_AUTO, durable);
+ *                  Writer_Dump("Key", key, len, DUMP_HEX, Pool_Free_Msg, NULL);    // release(data, hint) once written
+ *                  int f = Writer_Open("Plaintext.txt");
+ *                  Writer_Append(f, data, len, 0, NULL, NULL);     // NULL release: keep data alive until Writer_Finish
+ *                  Writer_Close(f);
+ *                  Writer_Finish();                                // 1 = every write made it
+_______________________________________________________________________________*/
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stddef.h>
+
+#define WRITER_DEPTH     64                     // io_uring entries, writes in flight
+#define WRITER_THREADS   4                      // fallback pool size
+#define WRITER_BLOCK     (256 * 1024)           // input bytes per queued write
+#define WRITER_MAX_FILES 32                     // files open at once
+#define WRITER_MAX_SYNCS 8                      // Writer_Track'ed files
+
+enum writer_backend {
+    WRITER_AUTO = 0,                   // io_uring, else threads
+    WRITER_IO_URING,
+    WRITER_POOL,                       // thread pool
+    WRITER_SYNC                        // no background writes at all
+};
+
+typedef void (*writer_release_fn)(void *data, void *hint);   // same shape as zmq_free_fn, so Pool_Free_Msg fits
+
+int Writer_Start(int backend, int durable);
+const char *Writer_Backend_Name(void);
+int Writer_Parse_Backend(const char *name);
+int Writer_Open(const char *fileName);
+int Writer_Open_Dump(const char *name, int mode);
+void Writer_Append(int file, const unsigned char *data, size_t len, int hex, writer_release_fn release, void *hint);
+void Writer_Close(int file);
+int Writer_Dump(const char *name, const unsigned char *data, size_t len, int mode, writer_release_fn release, void *hint);
+void Writer_Track(const char *fileName);
+int Writer_Finish(void);
+
+#endif